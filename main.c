@@ -1,11 +1,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 #include <mpi/mpi.h>
 
 #include <malloc.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <array>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <chrono>
 
 #include <opencv2/opencv.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -14,111 +33,3156 @@
 #include "utility.h"
 
 int PIXEL_SCALE = 12;
+int CELL_SIZE = 0; // lato in pixel del blocco NxN che diventa una cella, 0 = uguale a scale_size
 int operation_mode = 1;
+int distribution_mode = SPATIAL;
+int prefetch_frames = 8;
+int tile_rows = 4;
+int grid_columns = 0;
+int thread_count = 1;
+int use_simd = 1;
+int ramp_id = RAMP_SHORT;
+int render_mode = RENDER_GEOMETRY;
 char video_path[256] {0};
+char output_path[256] = "output.mp4";
+int chunk_frames = 48;
+char record_path[256] {0};
+char playback_path[256] {0};
+int delta_transport = 0;
+int transport_mode = TRANSPORT_MESSAGE;
+int cell_format = CELL_FULL;
+int palette_mode = PALETTE_NONE;
+int keyframe_interval = 30;
+int start_frame = 0;
+int realtime_mode = 0;
+int adaptive_mode = 0;
+int adaptive_max_cell = 0; // 0 = tre volte la cella di partenza
+char profile_output[256] {0};
+
+int width  = 0, 
+    height = 0;
+
+// La griglia di celle e' il video sottocampionato a blocchi di CELL_SIZE x CELL_SIZE pixel,
+// le righe/colonne che non riempiono un blocco intero vengono scartate
+#define ASCII_WIDTH (width / CELL_SIZE)
+#define ASCII_HEIGHT (height / CELL_SIZE)
+
+#define FONT_SIZE 16
+#define SEEK_SECONDS 5
+
+int nFrames,framerate = 0;
+
+MPI_Datatype sdl_color;
+MPI_Comm comm2D = MPI_COMM_NULL;    // topologia 2D, creata alla prima esecuzione di processFrames
+
+
+cv::VideoCapture videoStream;
+int videoStreamIndex = -1;
+
+int initOpenCV() {
+   videoStream = cv::VideoCapture(video_path);
+
+    if (!videoStream.isOpened()) {
+        std::cout << "Cannot open the video file.\n";
+        return -1;
+    }
+
+    return 0;
+}
+
+#pragma region Profilo_Stadi
+// Profilo per stadio (profile_output=file.csv o file.json, e sempre nel profiler): ogni rank somma il
+// tempo di ogni stadio nel frame corrente e a fine frame lo salva come campione. Alla fine i campioni
+// vanno a rank 0 con un Gatherv, che scrive min/p50/p95/p99/max per stadio e per rank (e su tutti i
+// rank insieme), piu' due stadi derivati: comm_wait (invii, attese e raccolte) e compute (convert + render).
+// result_send e' l'attesa dei worker per consegnare i propri risultati, gather_raster la raccolta
+// dell'immagine gia' rasterizzata su rank_first (renderer=software).
+// Gli stadi mai eseguiti da un rank (es. extract sui worker) non compaiono. Solo la distribuzione
+// spaziale a messaggi o RMA e' misurata: con le altre non ci sono campioni e il profilo non viene scritto.
+enum { STAGE_EXTRACT, STAGE_SEND, STAGE_CONVERT, STAGE_GATHER_INDEX, STAGE_GATHER_COLOR, STAGE_GATHER_RASTER, STAGE_RESULT_SEND, STAGE_RENDER, STAGES };
+#define STAGE_COMM    STAGES
+#define STAGE_COMPUTE (STAGES + 1)
+#define STAGE_REPORTS (STAGES + 2)
+
+const char *const stageNames[STAGE_REPORTS] = {"extract", "send", "convert", "gather_index", "gather_color", "gather_raster", "result_send", "render", "comm_wait", "compute"};
+
+struct StageProfile {
+    bool active;
+    int rank;                   // rank nel comunicatore 2D, per le etichette
+    double current[STAGES];
+    float *samples;             // STAGES valori in ms per ogni frame
+    int frames, capacity;
+};
+
+StageProfile stageProfile;
+
+// Uso: double t = MPI_Wtime(); ...stadio...; stageTime(STAGE_X, t);
+inline void stageTime(int stage, double since) {
+    if (stageProfile.active)
+        stageProfile.current[stage] += MPI_Wtime() - since;
+}
+
+void stageFrame() {
+    StageProfile &profile = stageProfile;
+    if (!profile.active)
+        return;
+
+    if (profile.frames == profile.capacity) {
+        profile.capacity = profile.capacity ? 2 * profile.capacity : 1024;
+        profile.samples = (float *)realloc(profile.samples, (size_t)profile.capacity * STAGES * sizeof(float));
+    }
+    for (int k = 0; k < STAGES; ++k) {
+        profile.samples[(size_t)profile.frames * STAGES + k] = profile.current[k] * 1000;
+        profile.current[k] = 0;
+    }
+    profile.frames++;
+}
+
+inline float stageSample(const float *frame, int stage) {
+    if (stage == STAGE_COMM)
+        return frame[STAGE_SEND] + frame[STAGE_GATHER_INDEX] + frame[STAGE_GATHER_COLOR] + frame[STAGE_GATHER_RASTER] + frame[STAGE_RESULT_SEND];
+    if (stage == STAGE_COMPUTE)
+        return frame[STAGE_CONVERT] + frame[STAGE_RENDER];
+    return frame[stage];
+}
+
+// Percentile nearest-rank su valori gia' ordinati
+inline float percentile(const float *sorted, int n, double q) {
+    int k = (int)(q * n + 0.999999) - 1;
+    return sorted[k < 0 ? 0 : (k >= n ? n - 1 : k)];
+}
+
+// Scrive una riga per stadio dei frames campioni in samples; label e' il rank o "all"
+void writeStageRows(FILE *file, bool json, bool *first, const char *label, const float *samples, int frames) {
+    float *values = (float *)malloc((frames + 1) * sizeof(float));
+
+    for (int stage = 0; stage < STAGE_REPORTS && frames > 0; ++stage) {
+        double total = 0;
+        for (int f = 0; f < frames; ++f) {
+            values[f] = stageSample(&samples[(size_t)f * STAGES], stage);
+            total += values[f];
+        }
+        if (total == 0)
+            continue;
+        std::sort(values, values + frames);
+
+        if (json)
+            fprintf(file, "%s\n    {\"rank\": \"%s\", \"stage\": \"%s\", \"frames\": %d, \"min_ms\": %.4f, \"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f, \"total_ms\": %.4f}",
+                    *first ? "" : ",", label, stageNames[stage], frames, values[0], percentile(values, frames, 0.5), percentile(values, frames, 0.95),
+                    percentile(values, frames, 0.99), values[frames - 1], total);
+        else
+            fprintf(file, "%s,%s,%d,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f\n", label, stageNames[stage], frames, values[0], percentile(values, frames, 0.5),
+                    percentile(values, frames, 0.95), percentile(values, frames, 0.99), values[frames - 1], total);
+        *first = false;
+    }
+    free(values);
+}
+
+// Collettiva su MPI_COMM_WORLD: raccoglie i campioni su rank 0, scrive path e azzera il profilo
+void reportStageProfile(const char *path) {
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    int local[2] = {stageProfile.rank, stageProfile.frames};
+    int *info = rank == 0 ? (int *)malloc(2 * size * sizeof(int)) : NULL;
+    int *counts = rank == 0 ? (int *)malloc(size * sizeof(int)) : NULL;
+    int *displs = rank == 0 ? (int *)malloc(size * sizeof(int)) : NULL;
+    float *all = NULL;
+    int total = 0;
+
+    MPI_Gather(local, 2, MPI_INT, info, 2, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        for (int r = 0; r < size; ++r) {
+            counts[r] = info[2 * r + 1] * STAGES;
+            displs[r] = total;
+            total += counts[r];
+        }
+        all = (float *)malloc((total + 1) * sizeof(float));
+    }
+    MPI_Gatherv(stageProfile.samples, stageProfile.frames * STAGES, MPI_FLOAT, all, counts, displs, MPI_FLOAT, 0, MPI_COMM_WORLD);
+
+    if (rank == 0 && total == 0) {
+        printf("No stage samples, %s not written: stages are timed only with distribution=spatial without transport=shared\n", path);
+    } else if (rank == 0) {
+        const bool json = strlen(path) > 5 && strcmp(path + strlen(path) - 5, ".json") == 0;
+        FILE *file = fopen(path, "w");
+        if (file == NULL) {
+            printf("Cannot write the profile to %s\n", path);
+        } else {
+            bool first = true;
+            char label[16];
+            if (json)
+                fprintf(file, "{\n  \"ranks\": %d,\n  \"stats\": [", size);
+            else
+                fprintf(file, "rank,stage,frames,min_ms,p50_ms,p95_ms,p99_ms,max_ms,total_ms\n");
+
+            // In ordine di rank del comunicatore 2D, poi tutti i rank insieme
+            for (int label2D = 0; label2D < size; ++label2D) {
+                for (int r = 0; r < size; ++r) {
+                    if (info[2 * r] != label2D)
+                        continue;
+                    sprintf(label, "%d", label2D);
+                    writeStageRows(file, json, &first, label, &all[displs[r]], info[2 * r + 1]);
+                }
+            }
+            writeStageRows(file, json, &first, "all", all, total / STAGES);
+
+            if (json)
+                fprintf(file, "\n  ]\n}\n");
+            fclose(file);
+            printf("Stage profile written to %s\n", path);
+        }
+    }
+
+    free(info);
+    free(counts);
+    free(displs);
+    free(all);
+    stageProfile.frames = 0;
+}
+
+// profile.csv -> profile_nogui.csv, per i due gruppi di esecuzioni del profiler
+void profilePath(char *out, const char *base, const char *suffix) {
+    const char *dot = strrchr(base, '.');
+    int stem = dot != NULL ? (int)(dot - base) : (int)strlen(base);
+    sprintf(out, "%.*s_%s%s", stem, base, suffix, dot != NULL ? dot : "");
+}
+#pragma endregion
+
+#pragma region Indice_Video
+// Indice dei frame salvato accanto al video (<video_path>.idx) e riusato finche' il video non cambia
+// (stessa dimensione e data di modifica). Per ogni frame, in ordine di presentazione: posizione del
+// pacchetto nel file, pts e flag keyframe. Rank 0 lo legge, o lo costruisce con ffprobe la prima
+// volta, e lo manda agli altri rank. Tutti i seek passano da seekCapture, che salta solo a keyframe.
+#define VIDEO_INDEX_VERSION 1
+
+struct VideoIndexHeader {
+    char magic[8];          // "ASCIIIDX"
+    uint32_t version;
+    uint32_t frames;
+    int64_t videoSize;
+    int64_t videoMtime;
+};
+
+struct VideoIndexEntry {
+    int64_t pos;            // -1 se ffprobe non la conosce
+    double pts;             // secondi
+    uint32_t keyframe;
+    uint32_t reserved;
+};
+
+struct VideoIndex {
+    int frames;
+    VideoIndexEntry *entries;
+    int keyframes;
+    int *keyframeList;      // frame keyframe, crescenti
+};
+
+VideoIndex *videoIndex = NULL;
+
+void indexPath(char *path) {
+    sprintf(path, "%s.idx", video_path);
+}
+
+// Ritorna NULL se manca il file o se il video e' cambiato da quando e' stato scritto
+VideoIndexEntry *readVideoIndex(const struct stat *video, int *frames) {
+    char path[300];
+    indexPath(path);
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+
+    VideoIndexHeader header;
+    VideoIndexEntry *entries = NULL;
+    if (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "ASCIIIDX", 8) == 0 && header.version == VIDEO_INDEX_VERSION &&
+        header.videoSize == (int64_t)video->st_size && header.videoMtime == (int64_t)video->st_mtime && header.frames > 0) {
+        entries = (VideoIndexEntry *)malloc(header.frames * sizeof(VideoIndexEntry));
+        if (fread(entries, sizeof(VideoIndexEntry), header.frames, file) != header.frames) {
+            free(entries);
+            entries = NULL;
+        }
+        *frames = header.frames;
+    }
+    fclose(file);
+    return entries;
+}
+
+// Mette un argomento tra apici singoli per la shell di popen/system (e per le liste di ffmpeg, che
+// usano la stessa sintassi): ogni ' diventa '\''. out deve avere 4 * strlen(in) + 3 byte.
+void shellQuote(char *out, const char *in) {
+    *out++ = '\'';
+    for (; *in != '\0'; ++in) {
+        if (*in == '\'') {
+            memcpy(out, "'\\''", 4);
+            out += 4;
+        } else {
+            *out++ = *in;
+        }
+    }
+    *out++ = '\'';
+    *out = '\0';
+}
+
+// ffprobe elenca i pacchetti in ordine di decodifica: ordinati per pts diventano i frame in ordine di presentazione
+VideoIndexEntry *buildVideoIndex(const struct stat *video, int *frames) {
+    char quoted[4 * sizeof(video_path) + 3], command[sizeof(quoted) + 160], line[128];
+    shellQuote(quoted, video_path);
+    sprintf(command, GET_VIDEO_INDEX, quoted);
+    FILE *probe = popen(command, "r");
+    if (probe == NULL)
+        return NULL;
+
+    int capacity = 1024, count = 0;
+    VideoIndexEntry *entries = (VideoIndexEntry *)malloc(capacity * sizeof(VideoIndexEntry));
+    while (fgets(line, sizeof(line), probe) != NULL) {
+        // pts_time,pos,flags
+        char *pos = strchr(line, ',');
+        char *flags = pos != NULL ? strchr(pos + 1, ',') : NULL;
+        if (flags == NULL || strncmp(line, "N/A", 3) == 0)
+            continue;
+
+        if (count == capacity) {
+            capacity *= 2;
+            entries = (VideoIndexEntry *)realloc(entries, capacity * sizeof(VideoIndexEntry));
+        }
+        entries[count].pts = atof(line);
+        entries[count].pos = strncmp(pos + 1, "N/A", 3) == 0 ? -1 : atoll(pos + 1);
+        entries[count].keyframe = flags[1] == 'K';
+        entries[count].reserved = 0;
+        count++;
+    }
+    pclose(probe);
+
+    if (count == 0) {
+        free(entries);
+        return NULL;
+    }
+    std::sort(entries, entries + count, [](const VideoIndexEntry &a, const VideoIndexEntry &b) { return a.pts < b.pts; });
+
+    // Se non si puo' scrivere accanto al video l'indice vale solo per questa esecuzione
+    char path[300];
+    indexPath(path);
+    FILE *file = fopen(path, "wb");
+    if (file != NULL) {
+        VideoIndexHeader header = {{'A', 'S', 'C', 'I', 'I', 'I', 'D', 'X'}, VIDEO_INDEX_VERSION, (uint32_t)count, (int64_t)video->st_size, (int64_t)video->st_mtime};
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(entries, sizeof(VideoIndexEntry), count, file);
+        fclose(file);
+    }
+
+    *frames = count;
+    return entries;
+}
+
+void loadVideoIndex(int rank) {
+    int frames = 0, cached = 0;
+    VideoIndexEntry *entries = NULL;
+
+    if (rank == 0) {
+        struct stat video;
+        if (stat(video_path, &video) == 0) {
+            entries = readVideoIndex(&video, &frames);
+            cached = entries != NULL;
+            if (entries == NULL)
+                entries = buildVideoIndex(&video, &frames);
+        }
+        if (entries == NULL)
+            frames = 0;
+    }
+
+    MPI_Bcast(&frames, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (frames == 0)
+        return;
+    if (rank != 0)
+        entries = (VideoIndexEntry *)malloc(frames * sizeof(VideoIndexEntry));
+    MPI_Bcast(entries, frames * sizeof(VideoIndexEntry), MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    videoIndex = (VideoIndex *)malloc(sizeof(VideoIndex));
+    videoIndex->frames = frames;
+    videoIndex->entries = entries;
+    videoIndex->keyframes = 0;
+    videoIndex->keyframeList = (int *)malloc(frames * sizeof(int));
+    for (int f = 0; f < frames; ++f) {
+        if (entries[f].keyframe)
+            videoIndex->keyframeList[videoIndex->keyframes++] = f;
+    }
+
+    if (rank == 0)
+        printf("Video index: %d frames, %d keyframes (%s)\n", frames, videoIndex->keyframes, cached ? "cached" : "built");
+}
+
+void freeVideoIndex() {
+    if (videoIndex == NULL)
+        return;
+    free(videoIndex->entries);
+    free(videoIndex->keyframeList);
+    free(videoIndex);
+    videoIndex = NULL;
+}
+
+// Ultimo keyframe non dopo il frame f
+int nearestKeyframe(int f) {
+    int lo = 0, hi = videoIndex->keyframes - 1, best = 0;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (videoIndex->keyframeList[mid] <= f) {
+            best = videoIndex->keyframeList[mid];
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return best;
+}
+
+// Porta capture al frame f, position e' il frame che la prossima read() restituira'.
+// Con l'indice il seek va sempre a un keyframe, dove OpenCV arriva al primo colpo, e poi si avanza
+// con grab() senza convertire; se f e' piu' avanti nello stesso GOP non si fa nessun seek.
+void seekCapture(cv::VideoCapture &capture, int &position, int f) {
+    if (position == f)
+        return;
+
+    if (videoIndex == NULL) {
+        capture.set(cv::CAP_PROP_POS_FRAMES, f);
+        position = f;
+        return;
+    }
+
+    int keyframe = nearestKeyframe(f);
+    if (position > f || position < keyframe) {
+        capture.set(cv::CAP_PROP_POS_FRAMES, keyframe);
+        position = keyframe;
+    }
+    while (position < f && capture.grab())
+        position++;
+}
+#pragma endregion
+
+#pragma region Tempo_Reale
+// Riproduzione in tempo reale (realtime=1): il frame n va presentato a start + (n - firstFrame) / framerate,
+// con start e firstFrame fissati dal primo frame presentato (e di nuovo dopo ogni seek).
+// Il decoder salta con grab(), senza retrieve ne' conversione, i frame che arriverebbero gia' in ritardo;
+// chi presenta aspetta la scadenza dei frame in anticipo e scarta un frame in ritardo di piu' di un
+// periodo, mai due di fila perche' l'immagine non resti ferma.
+struct RealtimeClock {
+    std::mutex lock;        // protegge tutta la struttura: il decoder legge l'orologio e aggiorna skipped
+    bool started;
+    double start;
+    int firstFrame;
+    double interval;        // media mobile del tempo tra due frame presentati
+    double lastPresent;
+    bool lastDropped;
+    long onTime, late, dropped, skipped;
+};
+
+RealtimeClock realtimeClock;
+double pacingSleep = 0;     // attese di frameDeadline, il controllo della risoluzione le toglie dal tempo per frame
+
+double wallTime() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void resetRealtimeClock() {
+    std::lock_guard<std::mutex> guard(realtimeClock.lock);
+    realtimeClock.started = false;
+    realtimeClock.interval = 0;
+    realtimeClock.lastDropped = false;
+    realtimeClock.onTime = realtimeClock.late = realtimeClock.dropped = realtimeClock.skipped = 0;
+}
+
+// Dopo un seek si riparte con l'orologio dal primo frame presentato
+void restartRealtimeClock() {
+    std::lock_guard<std::mutex> guard(realtimeClock.lock);
+    realtimeClock.started = false;
+}
+
+// Chiamata da chi presenta, prima di mostrare il frame: ritorna false se il frame va scartato
+bool frameDeadline(int frame) {
+    if (!realtime_mode || framerate <= 0)
+        return true;
+
+    RealtimeClock &clock = realtimeClock;
+    const double period = 1.0 / framerate;
+    double now = wallTime(), due;
+    {
+        std::lock_guard<std::mutex> guard(clock.lock);
+        if (!clock.started) {
+            clock.started = true;
+            clock.start = now;
+            clock.firstFrame = frame;
+        } else {
+            double elapsed = now - clock.lastPresent;
+            clock.interval = clock.interval == 0 ? elapsed : 0.9 * clock.interval + 0.1 * elapsed;
+        }
+        clock.lastPresent = now;
+        due = clock.start + (frame - clock.firstFrame) * period;
+    }
+
+    if (now < due) {
+        usleep((due - now) * 1e6);
+        pacingSleep += due - now;
+    }
+
+    std::lock_guard<std::mutex> guard(clock.lock);
+    if (now <= due + period) {
+        clock.onTime++;
+        clock.lastDropped = false;
+        return true;
+    }
+    if (!clock.lastDropped) {
+        clock.dropped++;
+        clock.lastDropped = true;
+        return false;
+    }
+    clock.late++;
+    clock.lastDropped = false;
+    return true;
+}
+
+// Frame da saltare prima di decodificare position: con buffered frame gia' in coda davanti, che escono
+// al ritmo del presentatore, arriverebbe oltre la propria scadenza piu' un periodo
+int skipLateFrames(cv::VideoCapture &capture, int &position, long buffered, int last) {
+    const double period = 1.0 / framerate;
+    double start, interval;
+    int firstFrame;
+    {
+        std::lock_guard<std::mutex> guard(realtimeClock.lock);
+        if (!realtimeClock.started)
+            return 0;
+        start = realtimeClock.start;
+        firstFrame = realtimeClock.firstFrame;
+        interval = realtimeClock.interval > period ? realtimeClock.interval : period;
+    }
+
+    const double ready = wallTime() + buffered * interval;
+    int skipped = 0;
+    while (position < last && ready > start + (position - firstFrame) * period + period && capture.grab()) {
+        position++;
+        skipped++;
+    }
+
+    std::lock_guard<std::mutex> guard(realtimeClock.lock);
+    realtimeClock.skipped += skipped;
+    return skipped;
+}
+
+// Se il decoder ha saltato dei frame il video finisce prima dei nFrames attesi, senza errori
+bool skippedToEnd() {
+    std::lock_guard<std::mutex> guard(realtimeClock.lock);
+    return realtime_mode && realtimeClock.skipped > 0;
+}
+
+void reportRealtime() {
+    if (!realtime_mode)
+        return;
+    std::lock_guard<std::mutex> guard(realtimeClock.lock);
+    printf("Realtime: %ld on time, %ld late, %ld dropped (%ld skipped before decoding, %ld not shown)\n",
+           realtimeClock.onTime, realtimeClock.late, realtimeClock.skipped + realtimeClock.dropped, realtimeClock.skipped, realtimeClock.dropped);
+}
+#pragma endregion
+
+// Ring di frame prefetchati: un thread decodifica il video in sequenza (niente seek per frame)
+// dentro buffer cv::Mat preallocati, il loop MPI li consuma in ordine.
+// acquireFrame() prende il prossimo frame pronto, releaseFrame() restituisce il piu' vecchio preso.
+struct FrameRing {
+    cv::Mat *slots;
+    int capacity;
+    long filled;    // frame scritti dal decoder
+    long acquired;  // frame presi dal consumatore
+    long released;  // frame restituiti al decoder
+    int position;   // prossimo frame del video che il decoder legge
+    int seekTo;     // seek chiesto dalla finestra, -1 se nessuno
+    int *numbers;   // numero nel video del frame in ogni slot
+    bool eof, stop;
+    std::mutex lock;
+    std::condition_variable frameReady, slotFree;
+    std::thread decoder;
+};
+
+void decoderLoop(FrameRing *ring) {
+    int position = ring->position;
+
+    while (1) {
+        std::unique_lock<std::mutex> guard(ring->lock);
+        ring->slotFree.wait(guard, [ring] { return ring->stop || ring->filled - ring->released < ring->capacity; });
+        if (ring->stop)
+            break;
+        cv::Mat *slot = &ring->slots[ring->filled % ring->capacity];
+        int seekTo = ring->seekTo;
+        long buffered = ring->filled - ring->acquired;
+        ring->seekTo = -1;
+        guard.unlock();
+
+        // Lo slot non e' visibile al consumatore finche' filled non avanza, quindi si decodifica senza lock
+        if (seekTo >= 0)
+            seekCapture(videoStream, position, seekTo);
+        if (realtime_mode && framerate > 0)
+            skipLateFrames(videoStream, position, buffered, start_frame + nFrames - 1);
+        bool ok = videoStream.read(*slot);
+        position++;
+
+        guard.lock();
+        ring->position = position;
+        ring->numbers[ring->filled % ring->capacity] = position - 1;
+        if (!ok) {
+            ring->eof = true;
+            ring->frameReady.notify_all();
+            break;
+        }
+        ring->filled++;
+        ring->frameReady.notify_all();
+    }
+}
+
+// memory, se presente, ospita gli slot uno dopo l'altro (es. una finestra MPI condivisa):
+// read() riusa il buffer di un cv::Mat della stessa dimensione e tipo, quindi decodifica li' dentro
+// Ring del decoder attivo, per i seek chiesti dalla finestra
+FrameRing *activeRing = NULL;
+
+void startDecoder(FrameRing *ring, int capacity, unsigned char *memory = NULL) {
+    ring->capacity = capacity;
+    ring->slots = new cv::Mat[capacity];
+    ring->numbers = new int[capacity];
+    ring->filled = ring->acquired = ring->released = 0;
+    ring->eof = ring->stop = false;
+    ring->position = 0;
+    ring->seekTo = -1;
+
+    // start_frame: si parte da meta' video
+    seekCapture(videoStream, ring->position, start_frame);
+    activeRing = ring;
+
+    for (int i = 0; i < capacity; ++i) {
+        if (memory != NULL)
+            ring->slots[i] = cv::Mat(height, width, CV_8UC3, &memory[(size_t)i * height * width * 3]);
+        else
+            ring->slots[i].create(height, width, CV_8UC3);
+    }
+
+    ring->decoder = std::thread(decoderLoop, ring);
+}
+
+// Ritorna NULL se il video e' finito
+cv::Mat *acquireFrame(FrameRing *ring) {
+    std::unique_lock<std::mutex> guard(ring->lock);
+    ring->frameReady.wait(guard, [ring] { return ring->eof || ring->filled > ring->acquired; });
+    if (ring->filled == ring->acquired)
+        return NULL;
+    return &ring->slots[ring->acquired++ % ring->capacity];
+}
+
+void releaseFrame(FrameRing *ring) {
+    std::lock_guard<std::mutex> guard(ring->lock);
+    ring->released++;
+    ring->slotFree.notify_one();
+}
+
+void stopDecoder(FrameRing *ring) {
+    {
+        std::lock_guard<std::mutex> guard(ring->lock);
+        ring->stop = true;
+        ring->slotFree.notify_one();
+    }
+    ring->decoder.join();
+    delete[] ring->slots;
+    delete[] ring->numbers;
+    activeRing = NULL;
+}
+
+int frameNumber(FrameRing *ring, const cv::Mat *frame) {
+    return ring->numbers[frame - ring->slots];
+}
+
+// Sposta il decoder di deltaFrames rispetto al frame presentato ora (quelli gia' nel ring si vedono comunque)
+void seekRing(int deltaFrames) {
+    if (activeRing == NULL)
+        return;
+
+    std::lock_guard<std::mutex> guard(activeRing->lock);
+    int shown = activeRing->position - (int)(activeRing->filled - activeRing->acquired);
+    int target = shown + deltaFrames;
+    int last = nFrames + start_frame - 1;
+    activeRing->seekTo = target < 0 ? 0 : (target > last ? last : target);
+    restartRealtimeClock();
+}
+
+#pragma region Pool_Thread
+// Pool di thread dentro ogni rank (threads=N in config.txt): convertStrip e rasterizeCells dividono
+// le righe di celle tra il thread MPI e threads-1 aiutanti, cosi' basta un rank per nodo o socket.
+// Gli aiutanti non chiamano mai MPI, per questo basta MPI_THREAD_FUNNELED.
+struct ThreadPool {
+    std::thread *helpers;
+    int count;                              // thread che lavorano, compreso quello MPI
+    std::mutex lock;
+    std::condition_variable start, done;
+    std::function<void(int, int)> job;      // job(prima riga, riga dopo l'ultima)
+    int rows;
+    long generation;
+    int finished;
+    bool stop;
+};
+
+ThreadPool pool;
+
+void poolLoop(int t) {
+    long seen = 0;
+    while (1) {
+        std::unique_lock<std::mutex> guard(pool.lock);
+        pool.start.wait(guard, [&seen] { return pool.stop || pool.generation != seen; });
+        if (pool.stop)
+            break;
+        seen = pool.generation;
+        guard.unlock();
+
+        // Il thread t prende la sua fetta di righe, job e rows non cambiano finche' tutti non hanno finito
+        pool.job(pool.rows * t / pool.count, pool.rows * (t + 1) / pool.count);
+
+        guard.lock();
+        if (++pool.finished == pool.count - 1)
+            pool.done.notify_one();
+    }
+}
+
+void startPool(int count) {
+    pool.count = count > 1 ? count : 1;
+    pool.generation = 0;
+    pool.finished = 0;
+    pool.stop = false;
+    pool.helpers = new std::thread[pool.count - 1];
+    for (int t = 1; t < pool.count; ++t)
+        pool.helpers[t - 1] = std::thread(poolLoop, t);
+}
+
+void stopPool() {
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.stop = true;
+    }
+    pool.start.notify_all();
+    for (int t = 1; t < pool.count; ++t)
+        pool.helpers[t - 1].join();
+    delete[] pool.helpers;
+}
+
+// Esegue job su rows righe divise tra i thread del pool, il thread chiamante fa la prima fetta
+void parallelRows(int rows, const std::function<void(int, int)> &job) {
+    if (pool.count <= 1 || rows < 2) {
+        job(0, rows);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(pool.lock);
+        pool.job = job;
+        pool.rows = rows;
+        pool.finished = 0;
+        pool.generation++;
+    }
+    pool.start.notify_all();
+
+    job(0, rows / pool.count);
+
+    std::unique_lock<std::mutex> guard(pool.lock);
+    pool.done.wait(guard, [] { return pool.finished == pool.count - 1; });
+}
+#pragma endregion
+
+
+// Rampe di caratteri ordinate in base alla "luminosità", un glifo UTF-8 per elemento.
+// Per aggiungere una rampa: nuovo array, nuova costante RAMP_* in utility.h e un case in selectConvertKernel
+const char *const rampShort[] = {" ", ".", ":", "-", "=", "+", "*", "#", "%", "@"};
+
+const char *const rampLong[] = {
+    " ", ".", "'", "`", "^", "\"", ",", ":", ";", "I", "l", "!", "i", ">", "<", "~", "+", "_", "-", "?",
+    "]", "[", "}", "{", "1", ")", "(", "|", "\\", "/", "t", "f", "j", "r", "x", "n", "u", "v", "c", "z",
+    "X", "Y", "U", "J", "C", "L", "Q", "0", "O", "Z", "m", "w", "q", "p", "d", "b", "k", "h", "a", "o",
+    "*", "#", "M", "W", "&", "8", "%", "B", "@", "$"
+};
+
+const char *const rampBlocks[] = {" ", "░", "▒", "▓", "█"};
+
+#define RAMP_LENGTH(ramp) ((int)(sizeof(ramp) / sizeof(ramp[0])))
+
+// Rampa scelta da config.txt
+const char *const *asciiChars = rampShort;
+int numChars = RAMP_LENGTH(rampShort);
+
+// Funzione per convertire il colore in scala di grigi
+uint8_t grayscale(uint8_t r, uint8_t g, uint8_t b) {
+    return (r+g+b) / 3;
+}
+
+// Indice del carattere per un valore di grigio con una rampa di n caratteri
+constexpr uint8_t getCharIndex(uint8_t grayscale, int n){
+    int _val =  grayscale * n / 255;
+
+    // Assicurati che l'indice sia compreso nell'intervallo corretto
+    return _val >= n ? n - 1 : _val;
+}
+
+// Funzione per ottenere il carattere ASCII corrispondente a un determinato valore di scala di grigi
+const char *getAsciiChar(uint8_t grayscale) {
+    // Mappatura del valore di scala di grigi all'indice del carattere ASCII
+    return asciiChars[getCharIndex(grayscale, numChars)];
+}
+
+#pragma region Kernel_Conversione
+// Tabelle generate a compile time per una rampa di N caratteri:
+// lut[g] e' l'indice del carattere per il grigio g,
+// thresholds[k] e' il primo grigio che da' indice >= k (usato dai kernel per rampe corte).
+template <int N>
+struct CharRamp {
+    static_assert(N >= 1 && N <= 256, "the character index must fit in a byte");
+
+    static constexpr std::array<uint8_t, 256> buildLut() {
+        std::array<uint8_t, 256> lut{};
+        for (int g = 0; g < 256; ++g)
+            lut[g] = getCharIndex(g, N);
+        return lut;
+    }
+
+    static constexpr std::array<uint8_t, 16> buildThresholds() {
+        std::array<uint8_t, 16> t{};
+        for (int k = 1, g = 0; k < N && k < 16; ++k) {
+            while (getCharIndex(g, N) < k)
+                ++g;
+            t[k] = g;
+        }
+        return t;
+    }
+
+    // Fino a 16 caratteri l'indice sta in 4 bit e si calcola con N-1 confronti SIMD,
+    // oltre si passa dalla tabella
+    static constexpr bool compareKernel = N <= 16;
+    static constexpr std::array<uint8_t, 256> lut = buildLut();
+    static constexpr std::array<uint8_t, 16> thresholds = buildThresholds();
+};
+
+// Converte una riga di w pixel BGR in indici e colori (SDL_Color in memoria e' b, g, r, 255).
+// La versione scalare e' il riferimento: le versioni SIMD devono dare esattamente lo stesso risultato.
+// Il grigio (r+g+b)/3 nei kernel SIMD e' calcolato come ((r+g+b) * 21846) >> 16, esatto per somme <= 765.
+typedef void (*ConvertRowFn)(const unsigned char *bgr, int w, unsigned char *asciiArtIdx, SDL_Color *asciiArtPixelColor);
+
+template <int N>
+void convertRow_scalar(const unsigned char *bgr, int w, unsigned char *asciiArtIdx, SDL_Color *asciiArtPixelColor) {
+    for (int x = 0; x < w; x++, bgr += 3) {
+        uint8_t b = bgr[0];
+        uint8_t g = bgr[1];
+        uint8_t r = bgr[2];
+
+        asciiArtIdx[x] = CharRamp<N>::lut[grayscale(r, g, b)];
+
+        //opencv usa bgr non rgb, quindi swap
+        SDL_Color c = {b, g, r, 255};
+        asciiArtPixelColor[x] = c;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// Indici di 16 pixel dal vettore dei grigi
+template <int N>
+__attribute__((target("sse4.1")))
+inline void storeIndices_sse41(__m128i gray, unsigned char *asciiArtIdx) {
+    if constexpr (CharRamp<N>::compareKernel) {
+        // indice = numero di soglie <= grigio, ogni confronto vero vale -1
+        __m128i idx = _mm_setzero_si128();
+        for (int k = 1; k < N; ++k) {
+            __m128i t = _mm_set1_epi8((char)CharRamp<N>::thresholds[k]);
+            idx = _mm_sub_epi8(idx, _mm_cmpeq_epi8(_mm_max_epu8(gray, t), gray));
+        }
+        _mm_storeu_si128((__m128i *)asciiArtIdx, idx);
+    } else {
+        alignas(16) unsigned char g[16];
+        _mm_store_si128((__m128i *)g, gray);
+        for (int k = 0; k < 16; ++k)
+            asciiArtIdx[k] = CharRamp<N>::lut[g[k]];
+    }
+}
+
+template <int N>
+__attribute__((target("sse4.1")))
+void convertRow_sse41(const unsigned char *bgr, int w, unsigned char *asciiArtIdx, SDL_Color *asciiArtPixelColor) {
+    // bgr bgr bgr bgr -> bgra bgra bgra bgra
+    const __m128i expand = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+    const __m128i ones = _mm_setr_epi8(1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0, 1, 1, 1, 0);
+    const __m128i third = _mm_set1_epi16(21846);
+
+    int x = 0;
+    // 16 pixel per giro, l'ultimo load legge 4 byte oltre i 48 usati: da qui il margine di 2 pixel
+    for (; x + 18 <= w; x += 16) {
+        const unsigned char *p = &bgr[x * 3];
+        __m128i p0 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 0)), expand), alpha);
+        __m128i p1 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 12)), expand), alpha);
+        __m128i p2 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 24)), expand), alpha);
+        __m128i p3 = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 36)), expand), alpha);
+
+        _mm_storeu_si128((__m128i *)&asciiArtPixelColor[x + 0], p0);
+        _mm_storeu_si128((__m128i *)&asciiArtPixelColor[x + 4], p1);
+        _mm_storeu_si128((__m128i *)&asciiArtPixelColor[x + 8], p2);
+        _mm_storeu_si128((__m128i *)&asciiArtPixelColor[x + 12], p3);
+
+        // maddubs: (b+g, r+0) per pixel, hadd: b+g+r
+        __m128i s01 = _mm_hadd_epi16(_mm_maddubs_epi16(p0, ones), _mm_maddubs_epi16(p1, ones));
+        __m128i s23 = _mm_hadd_epi16(_mm_maddubs_epi16(p2, ones), _mm_maddubs_epi16(p3, ones));
+        __m128i g = _mm_packus_epi16(_mm_mulhi_epu16(s01, third), _mm_mulhi_epu16(s23, third));
+
+        storeIndices_sse41<N>(g, &asciiArtIdx[x]);
+    }
+
+    convertRow_scalar<N>(&bgr[x * 3], w - x, &asciiArtIdx[x], &asciiArtPixelColor[x]);
+}
+
+template <int N>
+__attribute__((target("avx2")))
+void convertRow_avx2(const unsigned char *bgr, int w, unsigned char *asciiArtIdx, SDL_Color *asciiArtPixelColor) {
+    const __m256i expand = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                            0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+    const __m256i ones = _mm256_set1_epi32(0x00010101);
+    const __m256i third = _mm256_set1_epi16(21846);
+    // hadd e packus lavorano per lane da 128 bit: riordina i gruppi da 4 pixel
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    int x = 0;
+    // 32 pixel per giro, ogni vettore prende 8 pixel da due load di 16 byte (4 byte in piu' letti alla fine)
+    for (; x + 34 <= w; x += 32) {
+        const unsigned char *p = &bgr[x * 3];
+        __m256i q[4];
+
+        for (int k = 0; k < 4; ++k) {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(p + k * 24));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(p + k * 24 + 12));
+            q[k] = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), expand), alpha);
+            _mm256_storeu_si256((__m256i *)&asciiArtPixelColor[x + k * 8], q[k]);
+        }
+
+        __m256i s01 = _mm256_hadd_epi16(_mm256_maddubs_epi16(q[0], ones), _mm256_maddubs_epi16(q[1], ones));
+        __m256i s23 = _mm256_hadd_epi16(_mm256_maddubs_epi16(q[2], ones), _mm256_maddubs_epi16(q[3], ones));
+        __m256i g = _mm256_packus_epi16(_mm256_mulhi_epu16(s01, third), _mm256_mulhi_epu16(s23, third));
+        g = _mm256_permutevar8x32_epi32(g, order);
+
+        if constexpr (CharRamp<N>::compareKernel) {
+            __m256i idx = _mm256_setzero_si256();
+            for (int k = 1; k < N; ++k) {
+                __m256i t = _mm256_set1_epi8((char)CharRamp<N>::thresholds[k]);
+                idx = _mm256_sub_epi8(idx, _mm256_cmpeq_epi8(_mm256_max_epu8(g, t), g));
+            }
+            _mm256_storeu_si256((__m256i *)&asciiArtIdx[x], idx);
+        } else {
+            alignas(32) unsigned char gray[32];
+            _mm256_store_si256((__m256i *)gray, g);
+            for (int k = 0; k < 32; ++k)
+                asciiArtIdx[x + k] = CharRamp<N>::lut[gray[k]];
+        }
+    }
+
+    convertRow_sse41<N>(&bgr[x * 3], w - x, &asciiArtIdx[x], &asciiArtPixelColor[x]);
+}
+#endif
+
+#if defined(__ARM_NEON)
+template <int N>
+void convertRow_neon(const unsigned char *bgr, int w, unsigned char *asciiArtIdx, SDL_Color *asciiArtPixelColor) {
+    const uint16x4_t third = vdup_n_u16(21846);
+    const uint8x16_t alpha = vdupq_n_u8(255);
+
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        // vld3 separa direttamente i canali b, g, r
+        uint8x16x3_t px = vld3q_u8(&bgr[x * 3]);
+
+        uint16x8_t lo = vaddw_u8(vaddl_u8(vget_low_u8(px.val[0]), vget_low_u8(px.val[1])), vget_low_u8(px.val[2]));
+        uint16x8_t hi = vaddw_u8(vaddl_u8(vget_high_u8(px.val[0]), vget_high_u8(px.val[1])), vget_high_u8(px.val[2]));
+
+        uint16x8_t glo = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(lo), third), 16), vshrn_n_u32(vmull_u16(vget_high_u16(lo), third), 16));
+        uint16x8_t ghi = vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(hi), third), 16), vshrn_n_u32(vmull_u16(vget_high_u16(hi), third), 16));
+        uint8x16_t gray = vcombine_u8(vmovn_u16(glo), vmovn_u16(ghi));
+
+        uint8x16x4_t bgra = {{ px.val[0], px.val[1], px.val[2], alpha }};
+        vst4q_u8((uint8_t *)&asciiArtPixelColor[x], bgra);
+
+        if constexpr (CharRamp<N>::compareKernel) {
+            // vcgeq da' 0xFF dove grigio >= soglia: sottrarre equivale a contare le soglie superate
+            uint8x16_t idx = vdupq_n_u8(0);
+            for (int k = 1; k < N; ++k)
+                idx = vsubq_u8(idx, vcgeq_u8(gray, vdupq_n_u8(CharRamp<N>::thresholds[k])));
+            vst1q_u8(&asciiArtIdx[x], idx);
+        } else {
+            alignas(16) unsigned char g[16];
+            vst1q_u8(g, gray);
+            for (int k = 0; k < 16; ++k)
+                asciiArtIdx[x + k] = CharRamp<N>::lut[g[k]];
+        }
+    }
+
+    convertRow_scalar<N>(&bgr[x * 3], w - x, &asciiArtIdx[x], &asciiArtPixelColor[x]);
+}
+#endif
+
+ConvertRowFn convertRow = convertRow_scalar<RAMP_LENGTH(rampShort)>;
+
+// Sceglie il kernel migliore per la CPU su cui gira il rank, specializzato per una rampa di N caratteri
+template <int N>
+const char *selectKernelFor() {
+    convertRow = convertRow_scalar<N>;
+
+    if (!use_simd)
+        return "scalar";
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        convertRow = convertRow_avx2<N>;
+        return "avx2";
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        convertRow = convertRow_sse41<N>;
+        return "sse4.1";
+    }
+#elif defined(__ARM_NEON)
+    convertRow = convertRow_neon<N>;
+    return "neon";
+#endif
+
+    return "scalar";
+}
+
+const char *selectConvertKernel() {
+    switch (ramp_id) {
+        case RAMP_LONG:
+            asciiChars = rampLong;
+            numChars = RAMP_LENGTH(rampLong);
+            return selectKernelFor<RAMP_LENGTH(rampLong)>();
+        case RAMP_BLOCKS:
+            asciiChars = rampBlocks;
+            numChars = RAMP_LENGTH(rampBlocks);
+            return selectKernelFor<RAMP_LENGTH(rampBlocks)>();
+        default:
+            asciiChars = rampShort;
+            numChars = RAMP_LENGTH(rampShort);
+            return selectKernelFor<RAMP_LENGTH(rampShort)>();
+    }
+}
+#pragma endregion
+
+#pragma region Risoluzione_Adattiva
+// Controllo della risoluzione (adaptive=1): rank_first misura il tempo tra due frame presentati, che
+// comprende l'attesa del rank piu' lento, e lo confronta con il budget di 1/framerate.
+// I livelli partono da cell_size e ramp di config.txt: se la rampa e' quella lunga il primo passo
+// passa alla corta, poi ogni livello allarga la cella di un pixel (PIXEL_SCALE cresce con lei,
+// cosi' la finestra resta della stessa misura). Isteresi: si sale solo dopo un secondo sopra il budget,
+// si scende solo dopo due secondi sotto il 60%, e dopo ogni cambio la misura riparte da zero.
+// Le finestre sono in secondi e non in frame: con realtime=1 i frame in ritardo vengono saltati,
+// e proprio nel sovraccarico se ne presenterebbero troppo pochi per riempire una finestra in frame.
+// Il cambio ferma il ciclo dei frame come una chiusura della finestra; processFrames riparte dal
+// frame successivo con la nuova griglia (il seek passa dall'indice del video).
+struct ResolutionControl {
+    int level, maxLevel;
+    int baseCell, basePixel, baseRamp;
+    double frameTime;       // media mobile del tempo di lavoro per frame
+    double lastPresent, lastSleep;
+    double overSince;       // inizio del periodo sopra soglia, 0 se non lo e'
+    double underSince;      // inizio del periodo sotto soglia, 0 se non lo e'
+    double settleUntil;     // fino a quando ignorare la misura dopo un cambio, 0 = da fissare
+    int pending;            // livello chiesto, -1 se nessuno
+    int resumeFrame;
+};
+
+ResolutionControl resolution;
+
+void levelSettings(int level, int *cell, int *ramp) {
+    const int rampStep = resolution.baseRamp == RAMP_LONG ? 1 : 0;
+    *ramp = (level >= 1 && rampStep) ? RAMP_SHORT : resolution.baseRamp;
+    *cell = resolution.baseCell + (level >= rampStep ? level - rampStep : 0);
+}
+
+void initResolutionControl() {
+    resolution.level = 0;
+    resolution.baseCell = CELL_SIZE;
+    resolution.basePixel = PIXEL_SCALE;
+    resolution.baseRamp = ramp_id;
+    const int maxCell = adaptive_max_cell > CELL_SIZE ? adaptive_max_cell : 3 * CELL_SIZE;
+    resolution.maxLevel = maxCell - CELL_SIZE + (ramp_id == RAMP_LONG ? 1 : 0);
+    resolution.pending = -1;
+}
+
+// Da chiamare a ogni inizio di processFrames: la misura riparte con la griglia nuova
+void restartResolutionControl() {
+    resolution.frameTime = 0;
+    resolution.lastPresent = 0;
+    resolution.overSince = resolution.underSince = 0;
+    resolution.settleUntil = 0;
+    resolution.pending = -1;
+}
+
+// rank_first, a ogni frame presentato: ritorna true se il ciclo dei frame va fermato per cambiare livello
+bool resolutionCheck(int frame) {
+    if (!adaptive_mode || framerate <= 0)
+        return false;
+
+    ResolutionControl &control = resolution;
+    double now = MPI_Wtime();
+    if (control.lastPresent > 0) {
+        double work = now - control.lastPresent - (pacingSleep - control.lastSleep);
+        control.frameTime = control.frameTime == 0 ? work : 0.9 * control.frameTime + 0.1 * work;
+    }
+    control.lastPresent = now;
+    control.lastSleep = pacingSleep;
+
+    // Cambio gia' chiesto: i frame ancora in volo vengono presentati lo stesso, quindi si riparte
+    // dopo l'ultimo presentato e non da quello che ha fatto scattare il cambio
+    if (control.pending >= 0) {
+        if (frame + 1 >= start_frame + nFrames) {
+            control.pending = -1;
+            return false;
+        }
+        control.resumeFrame = frame + 1;
+        return true;
+    }
+
+    // Un secondo di assestamento dal primo frame presentato con la griglia nuova
+    if (control.settleUntil == 0)
+        control.settleUntil = now + 1;
+    if (now < control.settleUntil)
+        return false;
+
+    const double budget = 1.0 / framerate;
+    if (control.frameTime > budget * 1.05)
+        control.overSince = control.overSince > 0 ? control.overSince : now;
+    else
+        control.overSince = 0;
+    if (control.frameTime < budget * 0.6)
+        control.underSince = control.underSince > 0 ? control.underSince : now;
+    else
+        control.underSince = 0;
+
+    if (control.overSince > 0 && now - control.overSince >= 1 && control.level < control.maxLevel)
+        control.pending = control.level + 1;
+    else if (control.underSince > 0 && now - control.underSince >= 2 && control.level > 0)
+        control.pending = control.level - 1;
+    else {
+        control.pending = -1;
+        return false;
+    }
+
+    // All'ultimo frame non c'e' niente da cui ripartire
+    if (frame + 1 >= start_frame + nFrames) {
+        control.pending = -1;
+        return false;
+    }
+    control.resumeFrame = frame + 1;
+    return true;
+}
+
+bool resolutionPending() {
+    return resolution.pending >= 0;
+}
+
+// Tutti i rank, alla fine di processFrames: rank_first comunica se cambiare livello e da quale frame ripartire
+void syncResolution(MPI_Comm comm, int rank_first) {
+    int change[2] = {resolution.pending, resolution.resumeFrame};
+    MPI_Bcast(change, 2, MPI_INT, rank_first, comm);
+    resolution.pending = change[0];
+    resolution.resumeFrame = change[1];
+}
+
+// Applica il livello chiesto, ritorna false se non c'e' niente da cambiare
+bool applyResolutionChange(int rank) {
+    if (!adaptive_mode || resolution.pending < 0)
+        return false;
+
+    resolution.level = resolution.pending;
+    resolution.pending = -1;
+    levelSettings(resolution.level, &CELL_SIZE, &ramp_id);
+    PIXEL_SCALE = resolution.basePixel * CELL_SIZE / resolution.baseCell;
+    start_frame = resolution.resumeFrame;
+    selectConvertKernel();
+
+    if (rank == 0)
+        printf("Resolution level %d from frame %d: cell_size=%d, %d characters\n", resolution.level, start_frame, CELL_SIZE, numChars);
+    return true;
+}
+#pragma endregion
+
+void initializeSDL(SDL_Window **window, SDL_Renderer **renderer, TTF_Font **font) {
+    SDL_Init(SDL_INIT_VIDEO);
+    if (operation_mode == GRAPHICS)
+    {
+        *window = SDL_CreateWindow("Ascii video", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ASCII_WIDTH * PIXEL_SCALE, ASCII_HEIGHT * PIXEL_SCALE, 0);
+        if (!(*window)) {
+            printf("Errore durante la creazione della finestra: %s\n", SDL_GetError());
+            MPI_Finalize();
+            exit(1);
+        }
+        
+        *renderer = SDL_CreateRenderer(*window, -1, 0);
+        if (!(*renderer)) {
+            printf("Errore durante la creazione del renderer: %s\n", SDL_GetError());
+            SDL_DestroyWindow(*window);
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+    if (TTF_Init() == -1) {
+        printf("Errore durante l'inizializzazione della libreria TTF: %s\n", TTF_GetError());
+        SDL_DestroyRenderer(*renderer);
+        SDL_DestroyWindow(*window);
+        MPI_Finalize();
+        exit(1);
+    }
+    *font = TTF_OpenFont("sans.ttf", FONT_SIZE);
+    if (!(*font)) {
+        printf("Errore durante il caricamento del font: %s\n", TTF_GetError());
+        TTF_Quit();
+        SDL_DestroyRenderer(*renderer);
+        SDL_DestroyWindow(*window);
+        MPI_Finalize();
+        exit(1);
+    }
+}
+
+void destroySDL(SDL_Window *window, SDL_Renderer *renderer, TTF_Font *font) {
+    TTF_CloseFont(font);
+    TTF_Quit();
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+}
+
+// Finestra, renderer e font restano aperti tra due esecuzioni di processFrames se cambia solo la
+// griglia (adaptive=1), cosi' a ogni cambio di livello la finestra non si chiude e riapre
+struct Display {
+    SDL_Window *window;
+    SDL_Renderer *renderer;
+    TTF_Font *font;
+    int mode;                   // operation_mode per cui e' stata aperta
+};
+
+Display display = {NULL, NULL, NULL, -1};
+
+void closeDisplay() {
+    if (display.font == NULL)
+        return;
+    destroySDL(display.window, display.renderer, display.font);
+    display = {NULL, NULL, NULL, -1};
+}
+
+void openDisplay(SDL_Window **window, SDL_Renderer **renderer, TTF_Font **font) {
+    if (display.font != NULL && display.mode != operation_mode)
+        closeDisplay();
+
+    if (display.font == NULL) {
+        initializeSDL(&display.window, &display.renderer, &display.font);
+        display.mode = operation_mode;
+    } else if (display.window != NULL) {
+        // Con la cella nuova la griglia puo' perdere o guadagnare qualche pixel
+        SDL_SetWindowSize(display.window, ASCII_WIDTH * PIXEL_SCALE, ASCII_HEIGHT * PIXEL_SCALE);
+    }
+
+    *window = display.window;
+    *renderer = display.renderer;
+    *font = display.font;
+}
+
+#pragma region Palette
+// Quantizzazione opzionale dei colori su una palette fissa (xterm-256, 16 colori ANSI) o calcolata
+// una volta sola dal video. Un cubo 32x32x32 precalcolato da' per ogni colore a 5 bit per canale
+// la voce piu' vicina, cosi' la quantizzazione di una cella e' un solo accesso in tabella.
+SDL_Color palette[256];
+int paletteSize = 0;
+unsigned char *paletteLut = NULL;
+
+// SDL_Color contiene b, g, r: il cubo e' indicizzato come r, g, b a 5 bit
+inline int paletteBin(SDL_Color c) {
+    return ((c.b >> 3) << 10) | ((c.g >> 3) << 5) | (c.r >> 3);
+}
+
+inline SDL_Color paletteColor(int r, int g, int b) {
+    SDL_Color c = {(Uint8)b, (Uint8)g, (Uint8)r, 255};
+    return c;
+}
+
+// Colori di sistema di xterm, comuni alle due palette fisse
+const unsigned char ansiColors[16][3] = {
+    {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0}, {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0}, {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+};
+
+// Le voci sono nell'ordine dei codici xterm, quindi la voce e' anche il codice da usare sul terminale
+void buildFixedPalette() {
+    for (int i = 0; i < 16; ++i)
+        palette[i] = paletteColor(ansiColors[i][0], ansiColors[i][1], ansiColors[i][2]);
+    paletteSize = 16;
+
+    if (palette_mode != PALETTE_XTERM256)
+        return;
+
+    const int levels[6] = {0, 95, 135, 175, 215, 255};
+    for (int r = 0; r < 6; ++r)
+        for (int g = 0; g < 6; ++g)
+            for (int b = 0; b < 6; ++b)
+                palette[16 + r * 36 + g * 6 + b] = paletteColor(levels[r], levels[g], levels[b]);
+    for (int i = 0; i < 24; ++i)
+        palette[232 + i] = paletteColor(8 + i * 10, 8 + i * 10, 8 + i * 10);
+    paletteSize = 256;
+}
+
+// Palette per il video: istogramma a 5 bit per canale su alcuni frame distribuiti lungo il video,
+// le 256 celle del cubo piu' popolate diventano le voci (con il colore medio dei loro pixel)
+int buildAdaptivePalette() {
+    cv::VideoCapture capture(video_path);
+    if (!capture.isOpened())
+        return -1;
+
+    const int samples = 8;
+    int frames = capture.get(cv::CAP_PROP_FRAME_COUNT);
+    unsigned int *count = (unsigned int *)calloc(32768, sizeof(unsigned int));
+    unsigned long *sum = (unsigned long *)calloc(32768 * 3, sizeof(unsigned long));
+    cv::Mat frame;
+    int position = 0;
+
+    for (int s = 0; s < samples; ++s) {
+        if (frames > samples)
+            seekCapture(capture, position, (long)s * frames / samples);
+        if (!capture.read(frame))
+            break;
+        position++;
+
+        for (int y = 0; y < frame.rows; ++y) {
+            const unsigned char *row = frame.ptr(y);
+            for (int x = 0; x < frame.cols; ++x, row += 3) {
+                int bin = ((row[2] >> 3) << 10) | ((row[1] >> 3) << 5) | (row[0] >> 3);
+                count[bin]++;
+                sum[bin * 3 + 0] += row[2];
+                sum[bin * 3 + 1] += row[1];
+                sum[bin * 3 + 2] += row[0];
+            }
+        }
+    }
+
+    paletteSize = 0;
+    while (paletteSize < 256) {
+        int best = -1;
+        for (int bin = 0; bin < 32768; ++bin) {
+            if (count[bin] > 0 && (best < 0 || count[bin] > count[best]))
+                best = bin;
+        }
+        if (best < 0)
+            break;
+
+        palette[paletteSize++] = paletteColor(sum[best * 3] / count[best], sum[best * 3 + 1] / count[best], sum[best * 3 + 2] / count[best]);
+        count[best] = 0;
+    }
+
+    free(count);
+    free(sum);
+    capture.release();
+    return paletteSize > 0 ? 0 : -1;
+}
+
+void buildPaletteLut() {
+    paletteLut = (unsigned char *)malloc(32768);
+
+    for (int bin = 0; bin < 32768; ++bin) {
+        // centro della cella del cubo
+        int r = ((bin >> 10) << 3) + 4, g = (((bin >> 5) & 31) << 3) + 4, b = ((bin & 31) << 3) + 4;
+        int best = 0, bestDistance = 1 << 30;
+
+        for (int i = 0; i < paletteSize; ++i) {
+            int dr = r - palette[i].b, dg = g - palette[i].g, db = b - palette[i].r;
+            int distance = dr * dr + dg * dg + db * db;
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                best = i;
+            }
+        }
+        paletteLut[bin] = best;
+    }
+
+    // Un colore gia' quantizzato deve ritrovare la propria voce (serve a CELL_PALETTE): ogni voce
+    // possiede la cella del cubo in cui cade, e se due voci cadono nella stessa vince l'ultima
+    for (int i = 0; i < paletteSize; ++i)
+        paletteLut[paletteBin(palette[i])] = i;
+    for (int bin = 0; bin < 32768; ++bin)
+        paletteLut[bin] = paletteLut[paletteBin(palette[paletteLut[bin]])];
+}
+
+// Prepara palette e cubo su tutti i rank: quella adattiva la calcola rank 0 e la distribuisce
+void initPalette(int rank) {
+    if (palette_mode == PALETTE_NONE)
+        return;
+
+    if (palette_mode == PALETTE_ADAPTIVE) {
+        int ok = 0;
+        if (rank == 0)
+            ok = buildAdaptivePalette() == 0;
+        MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+        if (!ok) {
+            if (rank == 0)
+                printf("Cannot build the adaptive palette, using xterm-256\n");
+            palette_mode = PALETTE_XTERM256;
+        } else {
+            MPI_Bcast(&paletteSize, 1, MPI_INT, 0, MPI_COMM_WORLD);
+            MPI_Bcast(palette, paletteSize * sizeof(SDL_Color), MPI_BYTE, 0, MPI_COMM_WORLD);
+        }
+    }
+
+    if (palette_mode != PALETTE_ADAPTIVE)
+        buildFixedPalette();
+
+    free(paletteLut);
+    buildPaletteLut();
+}
+
+void quantizeColors(SDL_Color *asciiArtPixelColor, int n) {
+    for (int k = 0; k < n; ++k)
+        asciiArtPixelColor[k] = palette[paletteLut[paletteBin(asciiArtPixelColor[k])]];
+}
+#pragma endregion
+
+// Converte una porzione di frame BGR (stride = byte per riga) in indici dei caratteri e colori.
+// Ogni cella e' la media di un blocco CELL_SIZE x CELL_SIZE: le righe del blocco vengono sommate
+// in sequenza su tutta la larghezza, cosi' la lettura del frame resta lineare, poi la riga di medie
+// passa al kernel convertRow.
+// w e h sono in celle, la porzione deve contenere h * CELL_SIZE righe di pixel.
+// convertRows lavora sulle righe di celle [y0, y1) su un solo thread, convertStrip le divide tra i thread del pool.
+void convertRows(const unsigned char *pixels, size_t stride, int w, int y0, int y1, unsigned char *asciiArtIdx, SDL_Color *asciiArtPixelColor) {
+    const int n = CELL_SIZE;
+    const int h = y1 - y0;
+
+    pixels += (size_t)y0 * n * stride;
+    asciiArtIdx += y0 * w;
+    asciiArtPixelColor += y0 * w;
+
+    if (n == 1) {
+        for (int y = 0; y < h; y++)
+            convertRow(&pixels[y * stride], w, &asciiArtIdx[y * w], &asciiArtPixelColor[y * w]);
+
+        if (paletteLut != NULL)
+            quantizeColors(asciiArtPixelColor, w * h);
+        return;
+    }
+
+    const unsigned int area = n * n;
+    unsigned int *sums = (unsigned int *)malloc(w * 3 * sizeof(unsigned int));
+    unsigned char *average = (unsigned char *)malloc(w * 3);
+
+    for (int y = 0; y < h; y++) {
+        memset(sums, 0, w * 3 * sizeof(unsigned int));
+
+        for (int py = 0; py < n; py++) {
+            const unsigned char *row = &pixels[(y * n + py) * stride];
+            for (int x = 0; x < w; x++) {
+                for (int px = 0; px < n; px++, row += 3) {
+                    sums[x * 3 + 0] += row[0];
+                    sums[x * 3 + 1] += row[1];
+                    sums[x * 3 + 2] += row[2];
+                }
+            }
+        }
+
+        for (int i = 0; i < w * 3; i++)
+            average[i] = sums[i] / area;
+
+        convertRow(average, w, &asciiArtIdx[y * w], &asciiArtPixelColor[y * w]);
+    }
+
+    free(sums);
+    free(average);
+
+    if (paletteLut != NULL)
+        quantizeColors(asciiArtPixelColor, w * h);
+}
+
+void convertStrip(const unsigned char *pixels, size_t stride, int w, int h, unsigned char *asciiArtIdx, SDL_Color *asciiArtPixelColor) {
+    parallelRows(h, [=](int y0, int y1) {
+        convertRows(pixels, stride, w, y0, y1, asciiArtIdx, asciiArtPixelColor);
+    });
+}
+
+// Atlante dei glifi: tutti i caratteri della rampa in un'unica texture bianca, colorata dai vertici.
+// I buffer dei vertici e degli indici vengono riusati a ogni frame, cosi' l'intera griglia
+// parte con una sola chiamata a SDL_RenderGeometry.
+struct GlyphAtlas {
+    SDL_Texture *texture;
+    SDL_Rect *glyphRect;     // posizione di ogni glifo nell'atlante, in pixel
+    SDL_FPoint *glyphUV;     // angoli in alto a sinistra e in basso a destra di ogni glifo, normalizzati
+    SDL_Vertex *vertices;    // 4 vertici per cella
+    int *indices;            // 2 triangoli per cella
+    int cells;
+};
+
+GlyphAtlas *createGlyphAtlas(SDL_Renderer *renderer, TTF_Font *font) {
+    GlyphAtlas *atlas = (GlyphAtlas *)malloc(sizeof(GlyphAtlas));
+    atlas->glyphRect = (SDL_Rect *)malloc(numChars * sizeof(SDL_Rect));
+    atlas->glyphUV = (SDL_FPoint *)malloc(numChars * 2 * sizeof(SDL_FPoint));
+
+    SDL_Color textColor = {255, 255, 255, 255};
+    SDL_Surface **glyphs = (SDL_Surface **)malloc(numChars * sizeof(SDL_Surface *));
+    int slotWidth = 1, slotHeight = 1;
+
+    for (int i = 0; i < numChars; ++i) {
+        glyphs[i] = TTF_RenderUTF8_Blended(font, asciiChars[i], textColor);
+        if (glyphs[i]) {
+            slotWidth = glyphs[i]->w > slotWidth ? glyphs[i]->w : slotWidth;
+            slotHeight = glyphs[i]->h > slotHeight ? glyphs[i]->h : slotHeight;
+        }
+    }
+
+    // Glifi affiancati su una riga, copiati senza blending per tenere l'alpha del font
+    SDL_Surface *atlasSurface = SDL_CreateRGBSurfaceWithFormat(0, slotWidth * numChars, slotHeight, 32, SDL_PIXELFORMAT_ARGB8888);
+
+    for (int i = 0; i < numChars; ++i) {
+        SDL_Rect dest = {i * slotWidth, 0, glyphs[i] ? glyphs[i]->w : 0, glyphs[i] ? glyphs[i]->h : 0};
+
+        if (glyphs[i]) {
+            SDL_SetSurfaceBlendMode(glyphs[i], SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(glyphs[i], NULL, atlasSurface, &dest);
+            SDL_FreeSurface(glyphs[i]);
+        }
+
+        atlas->glyphRect[i] = dest;
+        atlas->glyphUV[i * 2 + 0].x = (float)dest.x / atlasSurface->w;
+        atlas->glyphUV[i * 2 + 0].y = 0.0f;
+        atlas->glyphUV[i * 2 + 1].x = (float)(dest.x + dest.w) / atlasSurface->w;
+        atlas->glyphUV[i * 2 + 1].y = (float)dest.h / atlasSurface->h;
+    }
+
+    atlas->texture = SDL_CreateTextureFromSurface(renderer, atlasSurface);
+    SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+    SDL_FreeSurface(atlasSurface);
+    free(glyphs);
+
+    // Le posizioni e gli indici non cambiano tra un frame e l'altro
+    atlas->cells = ASCII_WIDTH * ASCII_HEIGHT;
+    atlas->vertices = (SDL_Vertex *)malloc(atlas->cells * 4 * sizeof(SDL_Vertex));
+    atlas->indices = (int *)malloc(atlas->cells * 6 * sizeof(int));
+
+    for (int y = 0; y < ASCII_HEIGHT; y++) {
+        for (int x = 0; x < ASCII_WIDTH; x++) {
+            int k = y * ASCII_WIDTH + x;
+            SDL_Vertex *v = &atlas->vertices[k * 4];
+            int *i = &atlas->indices[k * 6];
+
+            v[0].position.x = v[2].position.x = x * PIXEL_SCALE;
+            v[1].position.x = v[3].position.x = (x + 1) * PIXEL_SCALE;
+            v[0].position.y = v[1].position.y = y * PIXEL_SCALE;
+            v[2].position.y = v[3].position.y = (y + 1) * PIXEL_SCALE;
+
+            i[0] = k * 4 + 0; i[1] = k * 4 + 1; i[2] = k * 4 + 2;
+            i[3] = k * 4 + 2; i[4] = k * 4 + 1; i[5] = k * 4 + 3;
+        }
+    }
+
+    return atlas;
+}
+
+void destroyGlyphAtlas(GlyphAtlas *atlas) {
+    if (atlas == NULL)
+        return;
+
+    SDL_DestroyTexture(atlas->texture);
+    free(atlas->glyphRect);
+    free(atlas->glyphUV);
+    free(atlas->vertices);
+    free(atlas->indices);
+    free(atlas);
+}
+
+void displayFrame(SDL_Renderer *renderer, GlyphAtlas *atlas, const unsigned char *allAsciiArtIdx, const SDL_Color *allAsciiArtPixelColor) {
+    SDL_RenderClear(renderer);
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    for (int k = 0; k < atlas->cells; k++) {
+        SDL_Color c = allAsciiArtPixelColor[k];
+        SDL_Color vertexColor = {c.b, c.g, c.r, 255};
+        const SDL_FPoint *uv = &atlas->glyphUV[allAsciiArtIdx[k] * 2];
+        SDL_Vertex *v = &atlas->vertices[k * 4];
+
+        v[0].color = v[1].color = v[2].color = v[3].color = vertexColor;
+        v[0].tex_coord.x = v[2].tex_coord.x = uv[0].x;
+        v[1].tex_coord.x = v[3].tex_coord.x = uv[1].x;
+        v[0].tex_coord.y = v[1].tex_coord.y = uv[0].y;
+        v[2].tex_coord.y = v[3].tex_coord.y = uv[1].y;
+    }
+
+    SDL_RenderGeometry(renderer, atlas->texture, atlas->vertices, atlas->cells * 4, atlas->indices, atlas->cells * 6);
+#else
+    // SDL senza RenderGeometry: una copia per cella, ma sempre dalla stessa texture
+    SDL_Rect destRect;
+    destRect.w = PIXEL_SCALE;
+    destRect.h = PIXEL_SCALE;
+    SDL_Color lastColor = {0, 0, 0, 0};
+
+    for (int y = 0; y < ASCII_HEIGHT; y++) {
+        for (int x = 0; x < ASCII_WIDTH; x++) {
+            destRect.x = x * PIXEL_SCALE;
+            destRect.y = y * PIXEL_SCALE;
+
+            SDL_Color c = allAsciiArtPixelColor[y * ASCII_WIDTH + x];
+
+            // Con la palette i colori si ripetono spesso: il color mod cambia solo quando serve
+            if (x + y == 0 || c.r != lastColor.r || c.g != lastColor.g || c.b != lastColor.b) {
+                SDL_SetTextureColorMod(atlas->texture, c.b, c.g, c.r);
+                lastColor = c;
+            }
+
+            SDL_RenderCopy(renderer, atlas->texture, &atlas->glyphRect[allAsciiArtIdx[y * ASCII_WIDTH + x]], &destRect);
+        }
+    }
+#endif
+
+    SDL_RenderPresent(renderer);
+}
+
+#pragma region Terminale
+// Output su terminale con colori ANSI a 24 bit. Si riscrivono solo le celle cambiate rispetto
+// al frame precedente: spostamento del cursore solo se non e' gia' sulla cella, cambio di colore
+// solo se diverso dall'ultimo emesso. Il frame viene composto in un buffer preallocato e scritto
+// con una sola write.
+struct TerminalOutput {
+    char *buffer;
+    unsigned char *prevIdx;
+    SDL_Color *prevColor;
+    int cells;
+    bool firstFrame;
+};
+
+// Caso peggiore per cella: "\x1b[rrrrr;ccccccH" + "\x1b[38;2;rrr;ggg;bbbm" + glifo UTF-8 di 4 byte
+#define TERMINAL_BYTES_PER_CELL 40
+
+inline char *appendNumber(char *out, int value) {
+    char digits[12];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (n)
+        *out++ = digits[--n];
+    return out;
+}
+
+inline char *appendString(char *out, const char *str) {
+    while (*str)
+        *out++ = *str++;
+    return out;
+}
+
+TerminalOutput *createTerminalOutput() {
+    TerminalOutput *terminal = (TerminalOutput *)malloc(sizeof(TerminalOutput));
+    terminal->cells = ASCII_WIDTH * ASCII_HEIGHT;
+    terminal->buffer = (char *)malloc(terminal->cells * TERMINAL_BYTES_PER_CELL + 64);
+    terminal->prevIdx = (unsigned char *)malloc(terminal->cells);
+    terminal->prevColor = (SDL_Color *)malloc(terminal->cells * sizeof(SDL_Color));
+    terminal->firstFrame = true;
+
+    // Nasconde il cursore e pulisce lo schermo
+    const char *init = "\x1b[?25l\x1b[2J";
+    write(STDOUT_FILENO, init, strlen(init));
+    return terminal;
+}
+
+void destroyTerminalOutput(TerminalOutput *terminal) {
+    if (terminal == NULL)
+        return;
+
+    // Ripristina colori e cursore e lascia il prompt sotto l'ultimo frame
+    char *out = terminal->buffer;
+    out = appendString(out, "\x1b[0m\x1b[");
+    out = appendNumber(out, ASCII_HEIGHT + 1);
+    out = appendString(out, ";1H\x1b[?25h\n");
+    write(STDOUT_FILENO, terminal->buffer, out - terminal->buffer);
+
+    free(terminal->buffer);
+    free(terminal->prevIdx);
+    free(terminal->prevColor);
+    free(terminal);
+}
+
+void displayTerminal(TerminalOutput *terminal, const unsigned char *allAsciiArtIdx, const SDL_Color *allAsciiArtPixelColor) {
+    char *out = terminal->buffer;
+    int cursorX = -1, cursorY = -1;
+    bool colorSet = false;
+    SDL_Color lastColor = {0, 0, 0, 0};
+
+    for (int y = 0; y < ASCII_HEIGHT; y++) {
+        for (int x = 0; x < ASCII_WIDTH; x++) {
+            int k = y * ASCII_WIDTH + x;
+            unsigned char idx = allAsciiArtIdx[k];
+            SDL_Color c = allAsciiArtPixelColor[k];
+
+            if (!terminal->firstFrame && idx == terminal->prevIdx[k] &&
+                c.r == terminal->prevColor[k].r && c.g == terminal->prevColor[k].g && c.b == terminal->prevColor[k].b)
+                continue;
+
+            terminal->prevIdx[k] = idx;
+            terminal->prevColor[k] = c;
+
+            if (cursorX != x || cursorY != y) {
+                out = appendString(out, "\x1b[");
+                out = appendNumber(out, y + 1);
+                *out++ = ';';
+                out = appendNumber(out, x + 1);
+                *out++ = 'H';
+            }
+
+            if (!colorSet || c.r != lastColor.r || c.g != lastColor.g || c.b != lastColor.b) {
+                // Con le palette fisse la voce e' il codice del terminale: escape piu' corti
+                if (palette_mode == PALETTE_XTERM256) {
+                    out = appendString(out, "\x1b[38;5;");
+                    out = appendNumber(out, paletteLut[paletteBin(c)]);
+                    *out++ = 'm';
+                } else if (palette_mode == PALETTE_ANSI16) {
+                    int entry = paletteLut[paletteBin(c)];
+                    out = appendString(out, "\x1b[");
+                    out = appendNumber(out, entry < 8 ? 30 + entry : 90 + entry - 8);
+                    *out++ = 'm';
+                } else {
+                    //SDL_Color contiene b, g, r
+                    out = appendString(out, "\x1b[38;2;");
+                    out = appendNumber(out, c.b);
+                    *out++ = ';';
+                    out = appendNumber(out, c.g);
+                    *out++ = ';';
+                    out = appendNumber(out, c.r);
+                    *out++ = 'm';
+                }
+                lastColor = c;
+                colorSet = true;
+            }
+
+            out = appendString(out, asciiChars[idx]);
+            cursorX = x + 1;
+            cursorY = y;
+        }
+    }
+
+    terminal->firstFrame = false;
+
+    size_t total = out - terminal->buffer, written = 0;
+    while (written < total) {
+        ssize_t n = write(STDOUT_FILENO, terminal->buffer + written, total - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+}
+#pragma endregion
+
+#pragma region Celle_Compatte
+// Formati compatti di una cella (indice + colore), usati per trasporto e registrazione:
+//   CELL_FULL   5 byte: indice, SDL_Color
+//   CELL_RGB565 3 byte: indice, colore a 16 bit 5-6-5 (little endian)
+//   CELL_RGB444 2 byte: indice a 4 bit e colore 4-4-4 in un uint16_t, solo per rampe fino a 16 glifi
+//   CELL_PALETTE 2 byte: indice, voce della palette (solo con palette attiva)
+// L'alpha non viene trasportato. RGB444 ha un percorso SSE2 (sempre presente su x86-64) a 8 celle per giro.
+inline int cellFormatBytes(int format) {
+    return (format == CELL_RGB444 || format == CELL_PALETTE) ? 2 : format == CELL_RGB565 ? 3 : 5;
+}
+
+void packCells(int format, const unsigned char *asciiArtIdx, const SDL_Color *asciiArtPixelColor, int n, unsigned char *out) {
+    if (format == CELL_RGB444) {
+        uint16_t *packed = (uint16_t *)out;
+        int k = 0;
+#if defined(__SSE2__)
+        const __m128i nibble = _mm_set1_epi32(0xF0);
+        for (; k + 8 <= n; k += 8) {
+            // per ogni colore (r, g, b, a) in un int32: (r>>4)<<8 | (g>>4)<<4 | b>>4
+            __m128i c0 = _mm_loadu_si128((const __m128i *)&asciiArtPixelColor[k]);
+            __m128i c1 = _mm_loadu_si128((const __m128i *)&asciiArtPixelColor[k + 4]);
+            __m128i p0 = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(c0, nibble), 4),
+                                                   _mm_and_si128(_mm_srli_epi32(c0, 8), nibble)),
+                                      _mm_and_si128(_mm_srli_epi32(c0, 20), _mm_set1_epi32(0x0F)));
+            __m128i p1 = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(_mm_and_si128(c1, nibble), 4),
+                                                   _mm_and_si128(_mm_srli_epi32(c1, 8), nibble)),
+                                      _mm_and_si128(_mm_srli_epi32(c1, 20), _mm_set1_epi32(0x0F)));
+            __m128i colors = _mm_packs_epi32(p0, p1);   // valori < 0x1000, nessuna saturazione
+            __m128i idx = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&asciiArtIdx[k]), _mm_setzero_si128());
+            _mm_storeu_si128((__m128i *)&packed[k], _mm_or_si128(colors, _mm_slli_epi16(idx, 12)));
+        }
+#endif
+        for (; k < n; ++k) {
+            SDL_Color c = asciiArtPixelColor[k];
+            packed[k] = (uint16_t)((asciiArtIdx[k] << 12) | ((c.r >> 4) << 8) | ((c.g >> 4) << 4) | (c.b >> 4));
+        }
+    } else if (format == CELL_PALETTE) {
+        for (int k = 0; k < n; ++k) {
+            out[k * 2] = asciiArtIdx[k];
+            out[k * 2 + 1] = paletteLut[paletteBin(asciiArtPixelColor[k])];
+        }
+    } else if (format == CELL_RGB565) {
+        for (int k = 0; k < n; ++k) {
+            SDL_Color c = asciiArtPixelColor[k];
+            unsigned int color = ((c.r >> 3) << 11) | ((c.g >> 2) << 5) | (c.b >> 3);
+            out[k * 3] = asciiArtIdx[k];
+            out[k * 3 + 1] = color & 0xFF;
+            out[k * 3 + 2] = color >> 8;
+        }
+    } else {
+        memcpy(out, asciiArtIdx, n);
+        memcpy(out + n, asciiArtPixelColor, n * sizeof(SDL_Color));
+    }
+}
+
+// I canali ridotti tornano a 8 bit replicando i bit alti, cosi' 0 e il massimo restano 0 e 255
+void unpackCells(int format, const unsigned char *in, int n, unsigned char *asciiArtIdx, SDL_Color *asciiArtPixelColor) {
+    if (format == CELL_RGB444) {
+        const uint16_t *packed = (const uint16_t *)in;
+        int k = 0;
+#if defined(__SSE2__)
+        const __m128i alpha = _mm_set1_epi32(0xFF000000);
+        for (; k + 8 <= n; k += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)&packed[k]);
+            _mm_storel_epi64((__m128i *)&asciiArtIdx[k], _mm_packus_epi16(_mm_srli_epi16(v, 12), _mm_setzero_si128()));
+
+            // ogni nibble n va nel proprio byte e diventa n * 17 = n | n << 4
+            __m128i w[2] = {_mm_unpacklo_epi16(v, _mm_setzero_si128()), _mm_unpackhi_epi16(v, _mm_setzero_si128())};
+            for (int h = 0; h < 2; ++h) {
+                __m128i t = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(w[h], 8), _mm_set1_epi32(0x0F)),
+                                                      _mm_and_si128(_mm_slli_epi32(w[h], 4), _mm_set1_epi32(0xF00))),
+                                         _mm_and_si128(_mm_slli_epi32(w[h], 16), _mm_set1_epi32(0xF0000)));
+                t = _mm_or_si128(_mm_or_si128(t, _mm_slli_epi32(t, 4)), alpha);
+                _mm_storeu_si128((__m128i *)&asciiArtPixelColor[k + h * 4], t);
+            }
+        }
+#endif
+        for (; k < n; ++k) {
+            unsigned int v = packed[k];
+            asciiArtIdx[k] = v >> 12;
+            asciiArtPixelColor[k].r = ((v >> 8) & 0xF) * 17;
+            asciiArtPixelColor[k].g = ((v >> 4) & 0xF) * 17;
+            asciiArtPixelColor[k].b = (v & 0xF) * 17;
+            asciiArtPixelColor[k].a = 255;
+        }
+    } else if (format == CELL_PALETTE) {
+        for (int k = 0; k < n; ++k) {
+            asciiArtIdx[k] = in[k * 2];
+            asciiArtPixelColor[k] = palette[in[k * 2 + 1]];
+        }
+    } else if (format == CELL_RGB565) {
+        for (int k = 0; k < n; ++k) {
+            unsigned int v = in[k * 3 + 1] | (in[k * 3 + 2] << 8);
+            unsigned int r = v >> 11, g = (v >> 5) & 0x3F, b = v & 0x1F;
+            asciiArtIdx[k] = in[k * 3];
+            asciiArtPixelColor[k].r = (r << 3) | (r >> 2);
+            asciiArtPixelColor[k].g = (g << 2) | (g >> 4);
+            asciiArtPixelColor[k].b = (b << 3) | (b >> 2);
+            asciiArtPixelColor[k].a = 255;
+        }
+    } else {
+        memcpy(asciiArtIdx, in, n);
+        memcpy(asciiArtPixelColor, in + n, n * sizeof(SDL_Color));
+    }
+}
+#pragma endregion
+
+#pragma region Contenitore_Ascii
+// Formato su disco della griglia di celle gia' convertita (byte order nativo):
+//   AsciiVideoHeader
+//   per ogni frame: cols*rows indici del glifo, poi cols*rows SDL_Color (b, g, r, 255),
+//   oppure cols*rows celle compatte se cellFormat non e' CELL_FULL
+//   indice finale: nFrames offset uint64_t dall'inizio del file, puntato da header.indexOffset
+// Il frame i si trova quindi in O(1) e il file si riproduce direttamente da mmap.
+#define ASCII_VIDEO_MAGIC   "ASCIIVID"
+#define ASCII_VIDEO_VERSION 2
+
+struct AsciiVideoHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t cols, rows;
+    uint32_t nFrames;
+    uint32_t framerate;
+    uint32_t rampId;
+    uint32_t cellFormat;    // CELL_FULL, CELL_RGB565, CELL_RGB444 o CELL_PALETTE (dalla versione 2)
+    uint32_t paletteSize;   // con CELL_PALETTE la palette (paletteSize SDL_Color) segue l'header
+    uint64_t indexOffset;   // 0 finche' la registrazione non e' chiusa
+};
+
+struct AsciiRecorder {
+    FILE *file;
+    uint64_t *offsets;
+    uint32_t frames, capacity;
+    uint64_t position;
+    int cellFormat;
+    unsigned char *packed;
+};
+
+AsciiRecorder *openRecorder(const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("Failed to open file: %s\n", path);
+        return NULL;
+    }
+
+    AsciiRecorder *recorder = (AsciiRecorder *)malloc(sizeof(AsciiRecorder));
+    recorder->file = file;
+    recorder->capacity = nFrames > 0 ? nFrames : 256;
+    recorder->offsets = (uint64_t *)malloc(recorder->capacity * sizeof(uint64_t));
+    recorder->frames = 0;
+    recorder->cellFormat = cell_format;
+    recorder->packed = (unsigned char *)malloc(ASCII_WIDTH * ASCII_HEIGHT * cellFormatBytes(cell_format));
+
+    // L'header viene riscritto alla chiusura con il numero di frame e l'offset dell'indice
+    AsciiVideoHeader header;
+    memset(&header, 0, sizeof(header));
+    fwrite(&header, sizeof(header), 1, file);
+    recorder->position = sizeof(header);
+
+    if (cell_format == CELL_PALETTE) {
+        fwrite(palette, sizeof(SDL_Color), paletteSize, file);
+        recorder->position += paletteSize * sizeof(SDL_Color);
+    }
+    return recorder;
+}
+
+void recordFrame(AsciiRecorder *recorder, const unsigned char *allAsciiArtIdx, const SDL_Color *allAsciiArtPixelColor) {
+    const int cells = ASCII_WIDTH * ASCII_HEIGHT;
+
+    if (recorder->frames == recorder->capacity) {
+        recorder->capacity *= 2;
+        recorder->offsets = (uint64_t *)realloc(recorder->offsets, recorder->capacity * sizeof(uint64_t));
+    }
+    recorder->offsets[recorder->frames++] = recorder->position;
+
+    packCells(recorder->cellFormat, allAsciiArtIdx, allAsciiArtPixelColor, cells, recorder->packed);
+    fwrite(recorder->packed, cellFormatBytes(recorder->cellFormat), cells, recorder->file);
+    recorder->position += cells * cellFormatBytes(recorder->cellFormat);
+}
+
+void closeRecorder(AsciiRecorder *recorder) {
+    if (recorder == NULL)
+        return;
+
+    fwrite(recorder->offsets, sizeof(uint64_t), recorder->frames, recorder->file);
+
+    AsciiVideoHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ASCII_VIDEO_MAGIC, sizeof(header.magic));
+    header.version = ASCII_VIDEO_VERSION;
+    header.cols = ASCII_WIDTH;
+    header.rows = ASCII_HEIGHT;
+    header.nFrames = recorder->frames;
+    header.framerate = framerate;
+    header.rampId = ramp_id;
+    header.cellFormat = recorder->cellFormat;
+    header.paletteSize = recorder->cellFormat == CELL_PALETTE ? paletteSize : 0;
+    header.indexOffset = recorder->position;
+
+    fseek(recorder->file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, recorder->file);
+    fclose(recorder->file);
+
+    free(recorder->offsets);
+    free(recorder->packed);
+    free(recorder);
+}
+#pragma endregion
+
+#pragma region Rasterizzatore_Software
+// Glifi pre-rasterizzati come maschere di copertura PIXEL_SCALE x PIXEL_SCALE (un byte per pixel),
+// ogni rank ne ha una copia e disegna da solo la propria parte dell'immagine finale
+unsigned char *createGlyphBitmaps(TTF_Font *font) {
+    const int n = PIXEL_SCALE;
+    unsigned char *glyphBitmaps = (unsigned char *)malloc(numChars * n * n);
+    SDL_Color textColor = {255, 255, 255, 255};
+
+    for (int i = 0; i < numChars; ++i) {
+        unsigned char *mask = &glyphBitmaps[i * n * n];
+        SDL_Surface *rendered = TTF_RenderUTF8_Blended(font, asciiChars[i], textColor);
+        SDL_Surface *glyph = rendered ? SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0) : NULL;
+        SDL_FreeSurface(rendered);
+
+        if (glyph == NULL || glyph->w == 0 || glyph->h == 0) {
+            memset(mask, 0, n * n);
+            SDL_FreeSurface(glyph);
+            continue;
+        }
+
+        // Il glifo viene stirato sulla cella come faceva SDL_RenderCopy: media dell'alpha
+        // sull'area sorgente che finisce in ogni pixel della cella
+        SDL_LockSurface(glyph);
+        for (int ty = 0; ty < n; ty++) {
+            int sy0 = ty * glyph->h / n, sy1 = (ty + 1) * glyph->h / n;
+            if (sy1 <= sy0) sy1 = sy0 + 1;
+
+            for (int tx = 0; tx < n; tx++) {
+                int sx0 = tx * glyph->w / n, sx1 = (tx + 1) * glyph->w / n;
+                if (sx1 <= sx0) sx1 = sx0 + 1;
+
+                unsigned int sum = 0;
+                for (int sy = sy0; sy < sy1; sy++) {
+                    const Uint32 *row = (const Uint32 *)((const Uint8 *)glyph->pixels + sy * glyph->pitch);
+                    for (int sx = sx0; sx < sx1; sx++)
+                        sum += row[sx] >> 24;
+                }
+                mask[ty * n + tx] = sum / ((sy1 - sy0) * (sx1 - sx0));
+            }
+        }
+        SDL_UnlockSurface(glyph);
+        SDL_FreeSurface(glyph);
+    }
+
+    return glyphBitmaps;
+}
+
+// Disegna le righe di celle [y0, y1) in un framebuffer ARGB8888 (pitch in pixel), su sfondo nero.
+// SDL_Color e' salvato come b, g, r, 255 quindi in memoria e' gia' un pixel ARGB8888 little endian.
+void rasterizeRows(const unsigned char *asciiArtIdx, const SDL_Color *asciiArtPixelColor, int w, int y0, int y1, const unsigned char *glyphBitmaps, Uint32 *framebuffer, int pitch) {
+    const int n = PIXEL_SCALE;
+
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < w; x++) {
+            const unsigned char *mask = &glyphBitmaps[asciiArtIdx[y * w + x] * n * n];
+            SDL_Color c = asciiArtPixelColor[y * w + x];
+            Uint32 *out = &framebuffer[(y * n) * pitch + x * n];
+
+            for (int py = 0; py < n; py++, out += pitch, mask += n) {
+                for (int px = 0; px < n; px++) {
+                    unsigned int a = mask[px];
+                    out[px] = 0xFF000000u
+                            | (((c.b * a + 255) >> 8) << 16)
+                            | (((c.g * a + 255) >> 8) << 8)
+                            | ((c.r * a + 255) >> 8);
+                }
+            }
+        }
+    }
+}
+
+// Disegna w x h celle, le righe di celle sono divise tra i thread del pool
+void rasterizeCells(const unsigned char *asciiArtIdx, const SDL_Color *asciiArtPixelColor, int w, int h, const unsigned char *glyphBitmaps, Uint32 *framebuffer, int pitch) {
+    parallelRows(h, [=](int y0, int y1) {
+        rasterizeRows(asciiArtIdx, asciiArtPixelColor, w, y0, y1, glyphBitmaps, framebuffer, pitch);
+    });
+}
+
+void displayFramebuffer(SDL_Renderer *renderer, SDL_Texture *frameTexture, const Uint32 *framebuffer) {
+    SDL_UpdateTexture(frameTexture, NULL, framebuffer, ASCII_WIDTH * PIXEL_SCALE * sizeof(Uint32));
+    SDL_RenderCopy(renderer, frameTexture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
+#pragma endregion
+
+// Frecce sinistra/destra nella finestra: seek di SEEK_SECONDS, applicato dal decoder o dalla riproduzione
+int seekRequest = 0;
+
+int pollQuit() {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT)
+            return 1;
+        if (event.type == SDL_KEYDOWN && (event.key.keysym.sym == SDLK_LEFT || event.key.keysym.sym == SDLK_RIGHT))
+            seekRequest += (event.key.keysym.sym == SDLK_RIGHT ? 1 : -1) * SEEK_SECONDS * (framerate > 0 ? framerate : 25);
+    }
+
+    if (seekRequest != 0 && activeRing != NULL) {
+        seekRing(seekRequest);
+        seekRequest = 0;
+    }
+    return 0;
+}
+
+// Tutto cio' che serve per mostrare o rasterizzare un frame
+struct RenderContext {
+    SDL_Renderer *renderer;
+    GlyphAtlas *atlas;              // renderer=geometry, solo su rank_first
+    SDL_Texture *frameTexture;      // renderer=software, solo su rank_first
+    unsigned char *glyphBitmaps;    // renderer=software, su tutti i rank
+    TerminalOutput *terminal;       // mode=TERMINAL, solo su rank_first
+    AsciiRecorder *recorder;        // record_path, solo su rank_first
+};
+
+// Converte un frame intero nel risultato da presentare: celle (indici seguiti dai colori)
+// oppure, con il rasterizzatore software, l'immagine gia' disegnata (cellBuffer fa da appoggio)
+void convertFrame(const unsigned char *pixels, size_t stride, RenderContext *render, unsigned char *cellBuffer, unsigned char *result) {
+    const int cells = ASCII_WIDTH * ASCII_HEIGHT;
+
+    if (cellBuffer != NULL) {
+        convertStrip(pixels, stride, ASCII_WIDTH, ASCII_HEIGHT, cellBuffer, (SDL_Color *)&cellBuffer[cells]);
+        rasterizeCells(cellBuffer, (SDL_Color *)&cellBuffer[cells], ASCII_WIDTH, ASCII_HEIGHT, render->glyphBitmaps, (Uint32 *)result, ASCII_WIDTH * PIXEL_SCALE);
+    } else {
+        convertStrip(pixels, stride, ASCII_WIDTH, ASCII_HEIGHT, result, (SDL_Color *)&result[cells]);
+    }
+}
+
+#define TAG_FRAME  1
+#define TAG_RESULT 2
+#define TAG_STOP   3
+#define TAG_COLORS 4
+#define TAG_EOF    5    // fine anticipata del video in un intervallo, porta il primo frame mancante
+#define TAG_TILE   16   // TAG_TILE + numero del tile, per frame e risultati della distribuzione dinamica
+
+// Distribuzione temporale: ogni rank converte frame interi assegnati a round-robin,
+// rank_first decodifica, distribuisce e presenta i risultati nell'ordine corretto
+void processFramesTemporal(MPI_Comm comm, int rank, int size, int rank_first, FrameRing *ring, RenderContext *render) {
+    const int cells = ASCII_WIDTH * ASCII_HEIGHT;
+    const int frameBytes = width * height * 3;
+    const int cellBytes = cells * (sizeof(unsigned char) + sizeof(SDL_Color));
+    // Con il rasterizzatore software chi converte un frame lo disegna anche, e il risultato e' l'immagine
+    const int framebufferBytes = cells * PIXEL_SCALE * PIXEL_SCALE * sizeof(Uint32);
+    const bool rasterize = operation_mode == GRAPHICS && render_mode == RENDER_SOFTWARE;
+    const int resultBytes = rasterize ? framebufferBytes : cellBytes;
+    unsigned char *cellBuffer = rasterize ? (unsigned char *)malloc(cellBytes) : NULL;
+
+    if (rank != rank_first) {
+        #pragma region Worker_Temporale
+            unsigned char *imagePixels = (unsigned char *)malloc(frameBytes);
+            unsigned char *result = (unsigned char *)malloc(resultBytes);
+
+            while (1) {
+                MPI_Status status;
+                MPI_Probe(rank_first, MPI_ANY_TAG, comm, &status);
+
+                if (status.MPI_TAG == TAG_STOP) {
+                    MPI_Recv(NULL, 0, MPI_CHAR, rank_first, TAG_STOP, comm, &status);
+                    break;
+                }
+
+                MPI_Recv(imagePixels, frameBytes, MPI_CHAR, rank_first, TAG_FRAME, comm, &status);
+                convertFrame(imagePixels, width * 3, render, cellBuffer, result);
+                MPI_Send(result, resultBytes, MPI_CHAR, rank_first, TAG_RESULT, comm);
+            }
+
+            free(imagePixels);
+            free(result);
+            free(cellBuffer);
+        #pragma endregion
+        return;
+    }
+
+    // Buffer di riordino: ogni slot contiene il frame decodificato e il risultato convertito
+    // del frame i % window, cosi' i risultati possono arrivare in qualsiasi ordine
+    const int window = 2 * size;
+    cv::Mat **slotFrame = (cv::Mat **)malloc(window * sizeof(cv::Mat *));
+    unsigned char **slotResult = (unsigned char **)malloc(window * sizeof(unsigned char *));
+    MPI_Request *sendRequest = (MPI_Request *)malloc(window * sizeof(MPI_Request));
+    MPI_Request *recvRequest = (MPI_Request *)malloc(window * sizeof(MPI_Request));
+
+    for (int s = 0; s < window; ++s) {
+        slotResult[s] = (unsigned char *)malloc(resultBytes);
+        sendRequest[s] = MPI_REQUEST_NULL;
+        recvRequest[s] = MPI_REQUEST_NULL;
+    }
+
+    int quit = 0;
+    int dispatched = 0, presented = 0;
+
+    while (presented < dispatched || (dispatched < nFrames && quit == 0)) {
+        // Presenta il frame piu' vecchio se la finestra e' piena o non c'e' altro da distribuire
+        if (dispatched - presented == window || dispatched == nFrames || quit) {
+            #pragma region Presenta_Frame
+                int slot = presented % window;
+                MPI_Wait(&recvRequest[slot], MPI_STATUS_IGNORE);
+                MPI_Wait(&sendRequest[slot], MPI_STATUS_IGNORE);
+                const int number = frameNumber(ring, slotFrame[slot]);
+                const bool show = frameDeadline(number);
+                releaseFrame(ring);
+                quit |= resolutionCheck(number);
+
+                if (render->recorder != NULL)
+                    recordFrame(render->recorder, slotResult[slot], (SDL_Color *)&slotResult[slot][cells]);
+
+                if (operation_mode == GRAPHICS) {
+                    if (rasterize && show)
+                        displayFramebuffer(render->renderer, render->frameTexture, (Uint32 *)slotResult[slot]);
+                    else if (show)
+                        displayFrame(render->renderer, render->atlas, slotResult[slot], (SDL_Color *)&slotResult[slot][cells]);
+                    quit |= pollQuit();
+                } else if (operation_mode == TERMINAL) {
+                    if (show)
+                        displayTerminal(render->terminal, slotResult[slot], (SDL_Color *)&slotResult[slot][cells]);
+                } else if (presented % 10 == 0) {
+                    printf("Done %d frames out of %d\n", presented, nFrames);
+                }
+                presented++;
+            #pragma endregion
+            continue;
+        }
+
+        #pragma region Distribuisci_Frame
+            int slot = dispatched % window;
+            int owner = (rank_first + dispatched) % size;
+
+            slotFrame[slot] = acquireFrame(ring);
+
+            if (slotFrame[slot] == NULL) {
+                if (!skippedToEnd())
+                    printf("Failed to extract frame\n");
+                quit = 1;
+                continue;
+            }
+
+            if (owner == rank_first) {
+                convertFrame(slotFrame[slot]->data, slotFrame[slot]->step, render, cellBuffer, slotResult[slot]);
+            } else {
+                MPI_Isend(slotFrame[slot]->data, frameBytes, MPI_CHAR, owner, TAG_FRAME, comm, &sendRequest[slot]);
+                MPI_Irecv(slotResult[slot], resultBytes, MPI_CHAR, owner, TAG_RESULT, comm, &recvRequest[slot]);
+            }
+            dispatched++;
+        #pragma endregion
+    }
+
+    for (int r = 0; r < size; ++r) {
+        if (r != rank_first)
+            MPI_Send(NULL, 0, MPI_CHAR, r, TAG_STOP, comm);
+    }
+
+    for (int s = 0; s < window; ++s)
+        free(slotResult[s]);
+    free(slotResult);
+    free(sendRequest);
+    free(recvRequest);
+    free(slotFrame);
+    free(cellBuffer);
+}
+
+
+// Distribuzione dinamica: ogni frame e' tagliato in tile di tile_rows righe di celle, rank_first fa da
+// coda e consegna un tile alla volta a chi ha appena restituito il precedente, cosi' i rank piu' lenti
+// ne prendono meno. Quando non c'e' nessun risultato in arrivo rank_first converte un tile da se'.
+// Alla fine si stampa per ogni rank quanti tile ha convertito e quanto e' rimasto fermo ad aspettare.
+void processFramesDynamic(MPI_Comm comm, int rank, int size, int rank_first, FrameRing *ring, RenderContext *render,
+                          unsigned char *allAsciiArtIdx, SDL_Color *allAsciiArtPixelColor, Uint32 *framebuffer) {
+    const int tiles = (ASCII_HEIGHT + tile_rows - 1) / tile_rows;
+    const int tileCells = tile_rows * ASCII_WIDTH;
+    const int tilePixelBytes = tile_rows * CELL_SIZE * width * 3;
+    const int tileRaster = tileCells * PIXEL_SCALE * PIXEL_SCALE;
+    const bool rasterize = operation_mode == GRAPHICS && render_mode == RENDER_SOFTWARE;
+    // In NO_GUI il risultato vuoto serve solo come richiesta del prossimo tile
+    const bool sendResults = rasterize || operation_mode != NO_GUI || record_path[0] != '\0';
+
+    int tilesDone = 0;
+    double idle = 0;
+
+    if (rank != rank_first) {
+        #pragma region Worker_Dinamico
+            unsigned char *imagePixels = (unsigned char *)malloc(tilePixelBytes);
+            unsigned char *asciiArtIdx = (unsigned char *)malloc(tileCells);
+            SDL_Color *asciiArtPixelColor = (SDL_Color *)malloc(tileCells * sizeof(SDL_Color));
+            Uint32 *tileFramebuffer = rasterize ? (Uint32 *)malloc(tileRaster * sizeof(Uint32)) : NULL;
+
+            while (1) {
+                MPI_Status status;
+                double waitStart = MPI_Wtime();
+                MPI_Probe(rank_first, MPI_ANY_TAG, comm, &status);
+                idle += MPI_Wtime() - waitStart;
+
+                if (status.MPI_TAG == TAG_STOP) {
+                    MPI_Recv(NULL, 0, MPI_CHAR, rank_first, TAG_STOP, comm, &status);
+                    break;
+                }
+
+                int tile = status.MPI_TAG - TAG_TILE;
+                int rows = (tile + 1) * tile_rows <= ASCII_HEIGHT ? tile_rows : ASCII_HEIGHT - tile * tile_rows;
+                int cells = rows * ASCII_WIDTH;
+
+                MPI_Recv(imagePixels, tilePixelBytes, MPI_CHAR, rank_first, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
+                convertStrip(imagePixels, width * 3, ASCII_WIDTH, rows, asciiArtIdx, asciiArtPixelColor);
+                tilesDone++;
+
+                if (rasterize) {
+                    rasterizeCells(asciiArtIdx, asciiArtPixelColor, ASCII_WIDTH, rows, render->glyphBitmaps, tileFramebuffer, ASCII_WIDTH * PIXEL_SCALE);
+                    MPI_Send(tileFramebuffer, cells * PIXEL_SCALE * PIXEL_SCALE, MPI_UINT32_T, rank_first, status.MPI_TAG, comm);
+                } else if (sendResults) {
+                    MPI_Send(asciiArtIdx, cells, MPI_CHAR, rank_first, status.MPI_TAG, comm);
+                    MPI_Send(asciiArtPixelColor, cells, sdl_color, rank_first, status.MPI_TAG, comm);
+                } else {
+                    MPI_Send(NULL, 0, MPI_CHAR, rank_first, status.MPI_TAG, comm);
+                }
+            }
+
+            free(imagePixels);
+            free(asciiArtIdx);
+            free(asciiArtPixelColor);
+            free(tileFramebuffer);
+        #pragma endregion
+    } else {
+        int quit = 0;
+
+        for (int i = 0; i < nFrames && quit == 0; ++i) {
+            cv::Mat *frame = acquireFrame(ring);
+            if (frame == NULL) {
+                if (!skippedToEnd())
+                    printf("Failed to extract frame\n");
+                break;
+            }
+
+            #pragma region Coda_Tile
+                int next = 0, outstanding = 0;
+
+                // Un tile a testa per partire, poi uno nuovo a ogni risultato ricevuto
+                for (int r = 0; r < size && next < tiles; ++r) {
+                    if (r == rank_first)
+                        continue;
+                    MPI_Send(&frame->data[(size_t)next * tilePixelBytes], next == tiles - 1 ? (ASCII_HEIGHT - next * tile_rows) * CELL_SIZE * width * 3 : tilePixelBytes,
+                             MPI_CHAR, r, TAG_TILE + next, comm);
+                    next++;
+                    outstanding++;
+                }
+
+                while (outstanding > 0 || next < tiles) {
+                    int arrived = 0;
+                    MPI_Status status;
+                    MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &arrived, &status);
+
+                    // Nessun risultato pronto e ancora tile in coda: li converte rank_first
+                    if (!arrived && next < tiles) {
+                        int tile = next++;
+                        int rows = (tile + 1) * tile_rows <= ASCII_HEIGHT ? tile_rows : ASCII_HEIGHT - tile * tile_rows;
+                        convertStrip(&frame->data[(size_t)tile * tilePixelBytes], frame->step, ASCII_WIDTH, rows,
+                                     &allAsciiArtIdx[tile * tileCells], &allAsciiArtPixelColor[tile * tileCells]);
+                        if (rasterize)
+                            rasterizeCells(&allAsciiArtIdx[tile * tileCells], &allAsciiArtPixelColor[tile * tileCells], ASCII_WIDTH, rows,
+                                           render->glyphBitmaps, &framebuffer[(size_t)tile * tileRaster], ASCII_WIDTH * PIXEL_SCALE);
+                        tilesDone++;
+                        continue;
+                    }
+
+                    if (!arrived) {
+                        double waitStart = MPI_Wtime();
+                        MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
+                        idle += MPI_Wtime() - waitStart;
+                    }
+
+                    int source = status.MPI_SOURCE;
+                    int tile = status.MPI_TAG - TAG_TILE;
+                    int cells = ((tile + 1) * tile_rows <= ASCII_HEIGHT ? tile_rows : ASCII_HEIGHT - tile * tile_rows) * ASCII_WIDTH;
+
+                    if (rasterize) {
+                        MPI_Recv(&framebuffer[(size_t)tile * tileRaster], cells * PIXEL_SCALE * PIXEL_SCALE, MPI_UINT32_T, source, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
+                    } else if (sendResults) {
+                        MPI_Recv(&allAsciiArtIdx[tile * tileCells], cells, MPI_CHAR, source, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
+                        MPI_Recv(&allAsciiArtPixelColor[tile * tileCells], cells, sdl_color, source, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
+                    } else {
+                        MPI_Recv(NULL, 0, MPI_CHAR, source, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
+                    }
+                    outstanding--;
+
+                    if (next < tiles) {
+                        int rows = (next + 1) * tile_rows <= ASCII_HEIGHT ? tile_rows : ASCII_HEIGHT - next * tile_rows;
+                        MPI_Send(&frame->data[(size_t)next * tilePixelBytes], rows * CELL_SIZE * width * 3, MPI_CHAR, source, TAG_TILE + next, comm);
+                        next++;
+                        outstanding++;
+                    }
+                }
+            #pragma endregion
+
+            const int number = frameNumber(ring, frame);
+            const bool show = frameDeadline(number);
+            releaseFrame(ring);
+
+            #pragma region Display_Frame
+                if (render->recorder != NULL)
+                    recordFrame(render->recorder, allAsciiArtIdx, allAsciiArtPixelColor);
+
+                if (rasterize && show)
+                    displayFramebuffer(render->renderer, render->frameTexture, framebuffer);
+                else if (operation_mode == GRAPHICS && show)
+                    displayFrame(render->renderer, render->atlas, allAsciiArtIdx, allAsciiArtPixelColor);
+                else if (operation_mode == TERMINAL && show)
+                    displayTerminal(render->terminal, allAsciiArtIdx, allAsciiArtPixelColor);
+                else if (operation_mode == NO_GUI && i % 10 == 0)
+                    printf("Done %d frames out of %d\n", i, nFrames);
+
+                if (operation_mode == GRAPHICS)
+                    quit = pollQuit();
+                if (resolutionCheck(number))
+                    quit = 1;
+            #pragma endregion
+        }
+
+        for (int r = 0; r < size; ++r) {
+            if (r != rank_first)
+                MPI_Send(NULL, 0, MPI_CHAR, r, TAG_STOP, comm);
+        }
+    }
+
+    #pragma region Statistiche_Tile
+        int *allTiles = rank == rank_first ? (int *)malloc(size * sizeof(int)) : NULL;
+        double *allIdle = rank == rank_first ? (double *)malloc(size * sizeof(double)) : NULL;
+        MPI_Gather(&tilesDone, 1, MPI_INT, allTiles, 1, MPI_INT, rank_first, comm);
+        MPI_Gather(&idle, 1, MPI_DOUBLE, allIdle, 1, MPI_DOUBLE, rank_first, comm);
+
+        if (rank == rank_first) {
+            for (int r = 0; r < size; ++r)
+                printf("Rank %d: %d tiles, idle %.3fs\n", r, allTiles[r], allIdle[r]);
+        }
+        free(allTiles);
+        free(allIdle);
+    #pragma endregion
+}
+
+// Decodifica distribuita a intervalli (distribution=ranges): il video e' diviso in intervalli contigui
+// di almeno chunk_frames frame che partono da un keyframe, assegnati a round-robin. Ogni rank apre
+// video_path da solo, fa un seek all'inizio di ogni suo intervallo e da li' legge in sequenza, quindi
+// la decodifica scala con il numero di rank. rank_first presenta i frame in ordine, ricevendoli da chi
+// li ha convertiti (o convertendoli lui stesso per i suoi intervalli).
+// Alla fine, o se la finestra viene chiusa, rank_first manda TAG_STOP e scarta i risultati ancora
+// in viaggio finche' ogni rank non risponde con il proprio TAG_STOP.
+// Gli intervalli sono contati da start_frame, i keyframe vengono dall'indice del video
+int loadRangeStarts(int *rangeStarts) {
+    int ranges = 0;
+    rangeStarts[ranges++] = 0;
+
+    for (int k = 0; videoIndex != NULL && k < videoIndex->keyframes; ++k) {
+        int f = videoIndex->keyframeList[k] - start_frame;
+        if (f - rangeStarts[ranges - 1] >= chunk_frames && f < nFrames)
+            rangeStarts[ranges++] = f;
+    }
+
+    // Senza indice gli intervalli sono di chunk_frames frame e il seek al keyframe lo fa OpenCV
+    if (videoIndex == NULL) {
+        for (int f = chunk_frames; f < nFrames; f += chunk_frames)
+            rangeStarts[ranges++] = f;
+    }
+
+    printf("Decoding %d ranges on every rank, %s\n", ranges, videoIndex != NULL ? "keyframe aligned" : "no keyframe index");
+    rangeStarts[ranges] = nFrames;
+    return ranges;
+}
+
+void processFramesRanges(MPI_Comm comm, int rank, int size, int rank_first, RenderContext *render,
+                         unsigned char *allAsciiArtIdx, SDL_Color *allAsciiArtPixelColor, Uint32 *framebuffer) {
+    const int cells = ASCII_WIDTH * ASCII_HEIGHT;
+    const int rasterPixels = cells * PIXEL_SCALE * PIXEL_SCALE;
+    const bool rasterize = operation_mode == GRAPHICS && render_mode == RENDER_SOFTWARE;
+    // In NO_GUI senza registrazione arriva solo un messaggio vuoto per frame
+    const bool sendResults = rasterize || operation_mode != NO_GUI || record_path[0] != '\0';
+
+    int *rangeStarts = (int *)malloc((nFrames + 2) * sizeof(int));
+    int ranges = 0;
+    if (rank == rank_first)
+        ranges = loadRangeStarts(rangeStarts);
+    MPI_Bcast(&ranges, 1, MPI_INT, rank_first, comm);
+    MPI_Bcast(rangeStarts, ranges + 1, MPI_INT, rank_first, comm);
+
+    cv::VideoCapture capture(video_path);
+    if (!capture.isOpened()) {
+        printf("Rank %d: cannot open the video file %s\n", rank, video_path);
+        MPI_Abort(comm, 1);
+    }
+    cv::Mat frame;
+    int position = 0;
+
+    if (rank != rank_first) {
+        #pragma region Worker_Intervalli
+            // Due buffer: si converte il frame successivo mentre il precedente e' ancora in viaggio
+            unsigned char *asciiArtIdx2[2];
+            SDL_Color *asciiArtPixelColor2[2];
+            Uint32 *framebuffer2[2] = {NULL, NULL};
+            MPI_Request resultSend[2][2] = {{MPI_REQUEST_NULL, MPI_REQUEST_NULL}, {MPI_REQUEST_NULL, MPI_REQUEST_NULL}};
+            for (int b = 0; b < 2; ++b) {
+                asciiArtIdx2[b] = (unsigned char *)malloc(cells + 1);
+                asciiArtPixelColor2[b] = (SDL_Color *)malloc((cells + 1) * sizeof(SDL_Color));
+                if (rasterize)
+                    framebuffer2[b] = (Uint32 *)malloc(rasterPixels * sizeof(Uint32));
+            }
+
+            int stop = 0, b = 0;
+            for (int j = rank; j < ranges && !stop; j += size) {
+                seekCapture(capture, position, start_frame + rangeStarts[j]);
+
+                for (int f = rangeStarts[j]; f < rangeStarts[j + 1]; ++f) {
+                    MPI_Iprobe(rank_first, TAG_STOP, comm, &stop, MPI_STATUS_IGNORE);
+                    if (stop)
+                        break;
+                    // CAP_PROP_FRAME_COUNT puo' sovrastimare: rank_first aspetterebbe frame che non arrivano
+                    if (!capture.read(frame)) {
+                        int missing = start_frame + f;
+                        MPI_Send(&missing, 1, MPI_INT, rank_first, TAG_EOF, comm);
+                        stop = 1;
+                        break;
+                    }
+                    position++;
+
+                    MPI_Waitall(2, resultSend[b], MPI_STATUSES_IGNORE);
+                    if (rasterize) {
+                        convertStrip(frame.data, frame.step, ASCII_WIDTH, ASCII_HEIGHT, asciiArtIdx2[b], asciiArtPixelColor2[b]);
+                        rasterizeCells(asciiArtIdx2[b], asciiArtPixelColor2[b], ASCII_WIDTH, ASCII_HEIGHT, render->glyphBitmaps, framebuffer2[b], ASCII_WIDTH * PIXEL_SCALE);
+                        MPI_Isend(framebuffer2[b], rasterPixels, MPI_UINT32_T, rank_first, TAG_RESULT, comm, &resultSend[b][0]);
+                    } else if (sendResults) {
+                        convertStrip(frame.data, frame.step, ASCII_WIDTH, ASCII_HEIGHT, asciiArtIdx2[b], asciiArtPixelColor2[b]);
+                        MPI_Isend(asciiArtIdx2[b], cells, MPI_CHAR, rank_first, TAG_RESULT, comm, &resultSend[b][0]);
+                        MPI_Isend(asciiArtPixelColor2[b], cells, sdl_color, rank_first, TAG_COLORS, comm, &resultSend[b][1]);
+                    } else {
+                        convertStrip(frame.data, frame.step, ASCII_WIDTH, ASCII_HEIGHT, asciiArtIdx2[b], asciiArtPixelColor2[b]);
+                        MPI_Isend(NULL, 0, MPI_CHAR, rank_first, TAG_RESULT, comm, &resultSend[b][0]);
+                    }
+                    b = 1 - b;
+                }
+            }
+
+            // I risultati ancora in viaggio li riceve (o li scarta) rank_first, poi si conferma lo stop
+            for (int k = 0; k < 2; ++k)
+                MPI_Waitall(2, resultSend[k], MPI_STATUSES_IGNORE);
+            MPI_Recv(NULL, 0, MPI_CHAR, rank_first, TAG_STOP, comm, MPI_STATUS_IGNORE);
+            MPI_Send(NULL, 0, MPI_CHAR, rank_first, TAG_STOP, comm);
+
+            for (int k = 0; k < 2; ++k) {
+                free(asciiArtIdx2[k]);
+                free(asciiArtPixelColor2[k]);
+                free(framebuffer2[k]);
+            }
+        #pragma endregion
+    } else {
+        int quit = 0;
+
+        for (int j = 0; j < ranges && quit == 0; ++j) {
+            const int owner = j % size;
+
+            for (int f = rangeStarts[j]; f < rangeStarts[j + 1] && quit == 0; ++f) {
+                #pragma region Ricevi_Frame
+                    if (owner == rank_first) {
+                        seekCapture(capture, position, start_frame + f);
+                        if (!capture.read(frame)) {
+                            printf("Failed to extract frame\n");
+                            quit = 1;
+                            break;
+                        }
+                        position++;
+
+                        convertStrip(frame.data, frame.step, ASCII_WIDTH, ASCII_HEIGHT, allAsciiArtIdx, allAsciiArtPixelColor);
+                        if (rasterize)
+                            rasterizeCells(allAsciiArtIdx, allAsciiArtPixelColor, ASCII_WIDTH, ASCII_HEIGHT, render->glyphBitmaps, framebuffer, ASCII_WIDTH * PIXEL_SCALE);
+                    } else {
+                        // Il prossimo messaggio di owner e' il frame f oppure la fine del video
+                        MPI_Status status;
+                        MPI_Probe(owner, MPI_ANY_TAG, comm, &status);
+                        if (status.MPI_TAG == TAG_EOF) {
+                            int missing;
+                            MPI_Recv(&missing, 1, MPI_INT, owner, TAG_EOF, comm, MPI_STATUS_IGNORE);
+                            printf("Rank %d: video ended at frame %d\n", owner, missing);
+                            quit = 1;
+                            break;
+                        }
+
+                        if (rasterize) {
+                            MPI_Recv(framebuffer, rasterPixels, MPI_UINT32_T, owner, TAG_RESULT, comm, MPI_STATUS_IGNORE);
+                        } else if (sendResults) {
+                            MPI_Recv(allAsciiArtIdx, cells, MPI_CHAR, owner, TAG_RESULT, comm, MPI_STATUS_IGNORE);
+                            MPI_Recv(allAsciiArtPixelColor, cells, sdl_color, owner, TAG_COLORS, comm, MPI_STATUS_IGNORE);
+                        } else {
+                            MPI_Recv(NULL, 0, MPI_CHAR, owner, TAG_RESULT, comm, MPI_STATUS_IGNORE);
+                        }
+                    }
+                #pragma endregion
+
+                #pragma region Display_Frame
+                    const bool show = frameDeadline(start_frame + f);
+                    if (render->recorder != NULL)
+                        recordFrame(render->recorder, allAsciiArtIdx, allAsciiArtPixelColor);
+
+                    if (rasterize && show)
+                        displayFramebuffer(render->renderer, render->frameTexture, framebuffer);
+                    else if (operation_mode == GRAPHICS && show)
+                        displayFrame(render->renderer, render->atlas, allAsciiArtIdx, allAsciiArtPixelColor);
+                    else if (operation_mode == TERMINAL && show)
+                        displayTerminal(render->terminal, allAsciiArtIdx, allAsciiArtPixelColor);
+                    else if (operation_mode == NO_GUI && f % 10 == 0)
+                        printf("Done %d frames out of %d\n", f, nFrames);
+
+                    if (operation_mode == GRAPHICS)
+                        quit = pollQuit();
+                #pragma endregion
+            }
+        }
+
+        #pragma region Ferma_Worker
+            for (int r = 0; r < size; ++r) {
+                if (r != rank_first)
+                    MPI_Send(NULL, 0, MPI_CHAR, r, TAG_STOP, comm);
+            }
+
+            // Scarta i risultati di chi era avanti rispetto alla presentazione
+            unsigned char *discard = (unsigned char *)malloc(rasterize ? rasterPixels * sizeof(Uint32) : cells * sizeof(SDL_Color));
+            for (int stopped = 0; stopped < size - 1;) {
+                MPI_Status status;
+                int count;
+                MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
+                MPI_Get_count(&status, MPI_BYTE, &count);
+                MPI_Recv(discard, count, MPI_BYTE, status.MPI_SOURCE, status.MPI_TAG, comm, MPI_STATUS_IGNORE);
+                if (status.MPI_TAG == TAG_STOP)
+                    stopped++;
+            }
+            free(discard);
+        #pragma endregion
+    }
+
+    capture.release();
+    free(rangeStarts);
+}
+
+#pragma region Trasporto_Delta
+// Trasporto delta della griglia (delta=1, distribuzione spaziale): ogni rank ricorda la propria
+// striscia del frame precedente e manda a rank_first solo le celle cambiate, come bitmap
+// (un bit per cella) seguita da indici e colori delle celle marcate. Ogni keyframe_interval
+// frame si manda la striscia intera per risincronizzare.
+// rank_first tiene la griglia completa del frame precedente in allAsciiArtIdx/allAsciiArtPixelColor
+// e ci applica sopra i pacchetti.
+struct DeltaState {
+    int cells;                  // celle per striscia
+    int bitmapBytes;
+    int maxPacket;              // keyframe o delta con tutte le celle cambiate
+    unsigned char *prevIdx;
+    SDL_Color *prevColor;
+    unsigned char *packet;
+    unsigned char *packets;     // solo rank_first
+    int *sizes, *displs;        // solo rank_first
+    long sentBytes;             // traffico delta di tutti i rank (solo rank_first)
+    long fullBytes;             // traffico che avrebbe richiesto la griglia intera (solo rank_first)
+    long frames;
+};
+
+inline int deltaPacketBytes(int cells) {
+    return (cells + 7) / 8 + cells * (sizeof(unsigned char) + sizeof(SDL_Color));
+}
+
+// maxCells e' la striscia piu' alta, dimensiona lo spazio di ogni rank nel buffer di arrivo
+DeltaState *createDeltaState(int cells, int maxCells, int rank, int size, int rank_first) {
+    DeltaState *delta = (DeltaState *)malloc(sizeof(DeltaState));
+    delta->cells = cells;
+    delta->bitmapBytes = (cells + 7) / 8;
+    delta->maxPacket = deltaPacketBytes(maxCells);
+    delta->prevIdx = (unsigned char *)malloc(cells);
+    delta->prevColor = (SDL_Color *)malloc(cells * sizeof(SDL_Color));
+    delta->packet = (unsigned char *)malloc(delta->maxPacket);
+    delta->packets = NULL;
+    delta->sizes = delta->displs = NULL;
+    delta->sentBytes = delta->fullBytes = 0;
+    delta->frames = 0;
+
+    if (rank == rank_first) {
+        delta->packets = (unsigned char *)malloc((size_t)delta->maxPacket * size);
+        delta->sizes = (int *)malloc(size * sizeof(int));
+        delta->displs = (int *)malloc(size * sizeof(int));
+        for (int r = 0; r < size; ++r)
+            delta->displs[r] = r * delta->maxPacket;
+    }
+    return delta;
+}
+
+void destroyDeltaState(DeltaState *delta) {
+    if (delta == NULL)
+        return;
+    free(delta->prevIdx);
+    free(delta->prevColor);
+    free(delta->packet);
+    free(delta->packets);
+    free(delta->sizes);
+    free(delta->displs);
+    free(delta);
+}
+
+// Keyframe: indici e colori interi. Delta: bitmap, poi indici e colori delle sole celle cambiate
+int encodeDelta(DeltaState *delta, const unsigned char *asciiArtIdx, const SDL_Color *asciiArtPixelColor, bool keyframe) {
+    const int cells = delta->cells;
+    unsigned char *out = delta->packet;
+
+    int packetSize;
+
+    if (keyframe) {
+        memcpy(out, asciiArtIdx, cells);
+        memcpy(out + cells, asciiArtPixelColor, cells * sizeof(SDL_Color));
+        packetSize = cells * (sizeof(unsigned char) + sizeof(SDL_Color));
+    } else {
+        unsigned char *bitmap = out;
+        memset(bitmap, 0, delta->bitmapBytes);
+
+        int changed = 0;
+        for (int k = 0; k < cells; ++k) {
+            if (asciiArtIdx[k] != delta->prevIdx[k] || memcmp(&asciiArtPixelColor[k], &delta->prevColor[k], sizeof(SDL_Color)) != 0) {
+                bitmap[k >> 3] |= 1 << (k & 7);
+                changed++;
+            }
+        }
+
+        unsigned char *idxOut = out + delta->bitmapBytes;
+        SDL_Color *colorOut = (SDL_Color *)(idxOut + changed);
+        for (int k = 0; k < cells; ++k) {
+            if (bitmap[k >> 3] & (1 << (k & 7))) {
+                *idxOut++ = asciiArtIdx[k];
+                *colorOut++ = asciiArtPixelColor[k];
+            }
+        }
+        packetSize = delta->bitmapBytes + changed * (sizeof(unsigned char) + sizeof(SDL_Color));
+    }
+
+    memcpy(delta->prevIdx, asciiArtIdx, cells);
+    memcpy(delta->prevColor, asciiArtPixelColor, cells * sizeof(SDL_Color));
+    return packetSize;
+}
+
+// Il blocco e' largo blockWidth celle, nella griglia le sue righe distano ASCII_WIDTH celle
+void applyDelta(const unsigned char *packet, int cells, int blockWidth, bool keyframe, unsigned char *allAsciiArtIdx, SDL_Color *allAsciiArtPixelColor) {
+    const int bitmapBytes = (cells + 7) / 8;
+
+    if (keyframe) {
+        const SDL_Color *colorIn = (const SDL_Color *)(packet + cells);
+        for (int k = 0; k < cells; k += blockWidth) {
+            const int row = k / blockWidth * ASCII_WIDTH;
+            memcpy(&allAsciiArtIdx[row], packet + k, blockWidth);
+            memcpy(&allAsciiArtPixelColor[row], colorIn + k, blockWidth * sizeof(SDL_Color));
+        }
+        return;
+    }
+
+    const unsigned char *bitmap = packet;
+    int changed = 0;
+    for (int b = 0; b < bitmapBytes; ++b)
+        changed += __builtin_popcount(bitmap[b]);
+
+    const unsigned char *idxIn = packet + bitmapBytes;
+    const SDL_Color *colorIn = (const SDL_Color *)(idxIn + changed);
+    for (int k = 0; k < cells; ++k) {
+        if (bitmap[k >> 3] & (1 << (k & 7))) {
+            const int cell = k / blockWidth * ASCII_WIDTH + k % blockWidth;
+            allAsciiArtIdx[cell] = *idxIn++;
+            allAsciiArtPixelColor[cell] = *colorIn++;
+        }
+    }
+}
+
+// Sostituisce la catena degli indici e il Gather dei colori: il blocco di rank_first e' gia'
+// al suo posto nella griglia, gli altri rank mandano il pacchetto con un unico Gatherv
+void gatherDelta(DeltaState *delta, MPI_Comm comm, int rank, int size, int rank_first, int frameIndex,
+                 const unsigned char *asciiArtIdx, const SDL_Color *asciiArtPixelColor,
+                 unsigned char *allAsciiArtIdx, SDL_Color *allAsciiArtPixelColor, const int *cellCounts, const int *cellDispls, const int *colCounts) {
+    const bool keyframe = frameIndex % keyframe_interval == 0;
+    int packetSize = rank == rank_first ? 0 : encodeDelta(delta, asciiArtIdx, asciiArtPixelColor, keyframe);
+
+    MPI_Gather(&packetSize, 1, MPI_INT, delta->sizes, 1, MPI_INT, rank_first, comm);
+    MPI_Gatherv(delta->packet, packetSize, MPI_CHAR, delta->packets, delta->sizes, delta->displs, MPI_CHAR, rank_first, comm);
+
+    if (rank != rank_first)
+        return;
+
+    for (int r = 0; r < size; ++r) {
+        if (r == rank_first)
+            continue;
+        if (cellCounts[r] > 0)
+            applyDelta(&delta->packets[delta->displs[r]], cellCounts[r], colCounts[r], keyframe, &allAsciiArtIdx[cellDispls[r]], &allAsciiArtPixelColor[cellDispls[r]]);
+        delta->sentBytes += delta->sizes[r];
+        delta->fullBytes += cellCounts[r] * (sizeof(unsigned char) + sizeof(SDL_Color));
+    }
+    delta->frames++;
+}
+#pragma endregion
+
+// Uscita su file (mode=VIDEO_FILE): il video e' diviso in blocchi di chunk_frames frame assegnati
+// a round-robin, ogni rank decodifica da solo i propri blocchi, li rasterizza e li codifica in un
+// file parziale. Alla fine rank_first unisce le parti con ffmpeg senza ricodificare.
+void partPath(char *path, int chunk) {
+    sprintf(path, "%s.part%04d.mp4", output_path, chunk);
+}
+
+void processFramesToFile(MPI_Comm comm, int rank, int size, int rank_first, RenderContext *render) {
+    const int cells = ASCII_WIDTH * ASCII_HEIGHT;
+    const int outWidth = ASCII_WIDTH * PIXEL_SCALE, outHeight = ASCII_HEIGHT * PIXEL_SCALE;
+    const int chunks = (nFrames + chunk_frames - 1) / chunk_frames;
+
+    cv::VideoCapture capture(video_path);
+    if (!capture.isOpened()) {
+        printf("Rank %d: cannot open the video file %s\n", rank, video_path);
+        MPI_Abort(comm, 1);
+    }
+
+    unsigned char *cellBuffer = (unsigned char *)malloc(cells * (sizeof(unsigned char) + sizeof(SDL_Color)));
+    Uint32 *framebuffer = (Uint32 *)malloc(outWidth * outHeight * sizeof(Uint32));
+    // ARGB8888 little endian in memoria e' BGRA, basta togliere l'alpha per VideoWriter
+    cv::Mat rendered(outHeight, outWidth, CV_8UC4, framebuffer);
+    cv::Mat encoded;
+    cv::Mat frame;
+    char path[300];
+    int nextFrame = 0, written = 0, position = 0;
+
+    for (int c = 0; c < chunks; ++c) {
+        if ((rank_first + c) % size != rank)
+            continue;
+
+        int first = c * chunk_frames;
+        int last = first + chunk_frames < nFrames ? first + chunk_frames : nFrames;
+
+        // Il seek serve solo quando si salta ai blocchi degli altri rank
+        seekCapture(capture, position, start_frame + first);
+
+        partPath(path, c);
+        cv::VideoWriter writer;
+        if (!writer.open(path, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), framerate, cv::Size(outWidth, outHeight))) {
+            printf("Rank %d: cannot open %s for writing\n", rank, path);
+            MPI_Abort(comm, 1);
+        }
+
+        for (nextFrame = first; nextFrame < last && capture.read(frame); ++nextFrame, ++position) {
+            convertFrame(frame.data, frame.step, render, cellBuffer, (unsigned char *)framebuffer);
+            cv::cvtColor(rendered, encoded, cv::COLOR_BGRA2BGR);
+            writer.write(encoded);
+            written++;
+        }
+        writer.release();
+    }
+
+    capture.release();
+    free(cellBuffer);
+    free(framebuffer);
+
+    int total = 0;
+    MPI_Reduce(&written, &total, 1, MPI_INT, MPI_SUM, rank_first, comm);
+
+    if (rank != rank_first)
+        return;
+
+    #pragma region Unisci_Parti
+        // ffmpeg risolve i percorsi della lista rispetto alla cartella della lista stessa
+        char listPath[300], quotedList[4 * sizeof(listPath) + 3], quotedOutput[4 * sizeof(output_path) + 3];
+        char command[sizeof(quotedList) + sizeof(quotedOutput) + 64], entry[4 * sizeof(path) + 3];
+        sprintf(listPath, "%s.parts.txt", output_path);
+        FILE *list = fopen(listPath, "w");
+        if (list == NULL) {
+            printf("Failed to open file: %s\n", listPath);
+            return;
+        }
+        for (int c = 0; c < chunks; ++c) {
+            partPath(path, c);
+            const char *name = strrchr(path, '/');
+            shellQuote(entry, name ? name + 1 : path);
+            fprintf(list, "file %s\n", entry);
+        }
+        fclose(list);
+
+        shellQuote(quotedList, listPath);
+        shellQuote(quotedOutput, output_path);
+        sprintf(command, CONCAT_VIDEO_PARTS, quotedList, quotedOutput);
+        if (system(command) != 0) {
+            printf("Failed to concatenate the parts listed in %s\n", listPath);
+            return;
+        }
+
+        for (int c = 0; c < chunks; ++c) {
+            partPath(path, c);
+            remove(path);
+        }
+        remove(listPath);
+
+        printf("Written %d frames out of %d to %s\n", total, nFrames, output_path);
+    #pragma endregion
+}
+
+
+// Riproduzione di un file scritto con record_path: niente decode ne' MPI, i frame vengono letti
+// direttamente dalla mappatura del file (condivisa in page cache tra piu' riproduzioni)
+// Indici letti dal file: con una registrazione corrotta, o con un rampId sbagliato, finirebbero
+// fuori dalla rampa dei caratteri o dalla palette
+bool recordedCellsValid(int format, const unsigned char *packed, const unsigned char *asciiArtIdx, int n) {
+    unsigned char maxGlyph = 0, maxColor = 0;
+    for (int k = 0; k < n; ++k)
+        maxGlyph = std::max(maxGlyph, asciiArtIdx[k]);
+    if (format == CELL_PALETTE) {
+        for (int k = 0; k < n; ++k)
+            maxColor = std::max(maxColor, packed[k * 2 + 1]);
+    }
+    return maxGlyph < numChars && (format != CELL_PALETTE || maxColor < paletteSize);
+}
+
+int playRecording(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Failed to open file: %s\n", path);
+        return -1;
+    }
+
+    struct stat info;
+    fstat(fd, &info);
+    size_t fileSize = info.st_size;
+    if (fileSize < sizeof(AsciiVideoHeader)) {
+        printf("Invalid recording: %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    const unsigned char *data = (const unsigned char *)mmap(NULL, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("Failed to map file: %s\n", path);
+        return -1;
+    }
+    madvise((void *)data, fileSize, MADV_SEQUENTIAL);
+
+    AsciiVideoHeader header;
+    memcpy(&header, data, sizeof(header));
+
+    // Controlli scritti in modo da non andare in overflow con un header costruito ad arte:
+    // ogni frame e l'indice devono stare nel file, formato e rampa devono essere noti
+    if (memcmp(header.magic, ASCII_VIDEO_MAGIC, sizeof(header.magic)) != 0 || header.version != ASCII_VIDEO_VERSION ||
+        header.cellFormat > CELL_PALETTE || header.rampId > RAMP_BLOCKS ||
+        header.cols == 0 || header.rows == 0 || (uint64_t)header.cols * header.rows > fileSize || (uint64_t)header.cols * header.rows > INT_MAX ||
+        header.indexOffset == 0 || header.indexOffset > fileSize || header.nFrames > (fileSize - header.indexOffset) / sizeof(uint64_t)) {
+        printf("Invalid recording: %s\n", path);
+        munmap((void *)data, fileSize);
+        return -1;
+    }
+
+    // La griglia registrata e' gia' in celle: una cella per "pixel"
+    width = header.cols;
+    height = header.rows;
+    CELL_SIZE = 1;
+    nFrames = header.nFrames;
+    framerate = header.framerate;
+    ramp_id = header.rampId;
+    selectConvertKernel();
 
-int width  = 0, 
-    height = 0;
+    const uint64_t *offsets = (const uint64_t *)(data + header.indexOffset);
+    const size_t frameBytes = (size_t)header.cols * header.rows * cellFormatBytes(header.cellFormat);
 
-#define ASCII_WIDTH width
-#define ASCII_HEIGHT height
+    if (header.cellFormat == CELL_PALETTE) {
+        if (header.paletteSize == 0 || header.paletteSize > 256 || sizeof(header) + header.paletteSize * sizeof(SDL_Color) > fileSize) {
+            printf("Invalid recording: %s\n", path);
+            munmap((void *)data, fileSize);
+            return -1;
+        }
+        paletteSize = header.paletteSize;
+        memcpy(palette, data + sizeof(header), paletteSize * sizeof(SDL_Color));
+    }
 
-#define FONT_SIZE 16
+    SDL_Window *window = NULL;
+    SDL_Renderer *renderer = NULL;
+    TTF_Font *font = NULL;
+    GlyphAtlas *atlas = NULL;
+    SDL_Texture *frameTexture = NULL;
+    unsigned char *glyphBitmaps = NULL;
+    Uint32 *framebuffer = NULL;
+    TerminalOutput *terminal = NULL;
 
-int nFrames,framerate = 0;
+    if (operation_mode == GRAPHICS) {
+        initializeSDL(&window, &renderer, &font);
+        if (render_mode == RENDER_SOFTWARE) {
+            frameTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, ASCII_WIDTH * PIXEL_SCALE, ASCII_HEIGHT * PIXEL_SCALE);
+            glyphBitmaps = createGlyphBitmaps(font);
+            framebuffer = (Uint32 *)malloc(ASCII_WIDTH * PIXEL_SCALE * ASCII_HEIGHT * PIXEL_SCALE * sizeof(Uint32));
+        } else {
+            atlas = createGlyphAtlas(renderer, font);
+        }
+    } else if (operation_mode == TERMINAL) {
+        terminal = createTerminalOutput();
+    }
 
-MPI_Datatype sdl_color;
+    const int cells = ASCII_WIDTH * ASCII_HEIGHT;
+    const int first = start_frame < nFrames ? start_frame : 0;
+    double start = MPI_Wtime() - (framerate > 0 ? (double)first / framerate : 0);
 
+    // Le celle compatte vanno espanse prima di disegnarle, quelle intere si leggono dalla mappatura
+    unsigned char *unpackedIdx = header.cellFormat != CELL_FULL ? (unsigned char *)malloc(cells) : NULL;
+    SDL_Color *unpackedColors = header.cellFormat != CELL_FULL ? (SDL_Color *)malloc(cells * sizeof(SDL_Color)) : NULL;
+    int quit = 0;
 
-cv::VideoCapture videoStream;
-int videoStreamIndex = -1;
+    for (int i = first; i < nFrames && quit == 0; ++i) {
+        // Con l'indice dei frame della registrazione il seek e' solo un cambio di i, poi si riallinea l'orologio
+        if (seekRequest != 0) {
+            i += seekRequest;
+            i = i < 0 ? 0 : (i >= nFrames ? nFrames - 1 : i);
+            seekRequest = 0;
+            if (framerate > 0)
+                start = MPI_Wtime() - (double)i / framerate;
+        }
 
-int initOpenCV() {
-   videoStream = cv::VideoCapture(video_path);
+        if (offsets[i] > fileSize || frameBytes > fileSize - offsets[i]) {
+            printf("Frame %d is out of the file\n", i);
+            break;
+        }
 
-    if (!videoStream.isOpened()) {
-        std::cout << "Cannot open the video file.\n";
-        return -1;
+        const unsigned char *idx = data + offsets[i];
+        const SDL_Color *colors = (const SDL_Color *)(idx + cells);
+        if (header.cellFormat != CELL_FULL) {
+            unpackCells(header.cellFormat, idx, cells, unpackedIdx, unpackedColors);
+            idx = unpackedIdx;
+            colors = unpackedColors;
+        }
+        if (!recordedCellsValid(header.cellFormat, data + offsets[i], idx, cells)) {
+            printf("Frame %d has glyph or palette indices out of range\n", i);
+            break;
+        }
+
+        // Senza decode la riproduzione andrebbe a velocita' libera: si rispetta il framerate originale
+        if (operation_mode != NO_GUI && framerate > 0) {
+            double wait = start + (double)i / framerate - MPI_Wtime();
+            if (wait > 0)
+                usleep(wait * 1e6);
+        }
+
+        if (operation_mode == GRAPHICS) {
+            if (render_mode == RENDER_SOFTWARE) {
+                rasterizeCells(idx, colors, ASCII_WIDTH, ASCII_HEIGHT, glyphBitmaps, framebuffer, ASCII_WIDTH * PIXEL_SCALE);
+                displayFramebuffer(renderer, frameTexture, framebuffer);
+            } else {
+                displayFrame(renderer, atlas, idx, colors);
+            }
+            quit = pollQuit();
+        } else if (operation_mode == TERMINAL) {
+            displayTerminal(terminal, idx, colors);
+        } else if (i % 10 == 0) {
+            printf("Done %d frames out of %d\n", i, nFrames);
+        }
     }
 
+    destroyTerminalOutput(terminal);
+    if (operation_mode == GRAPHICS) {
+        destroyGlyphAtlas(atlas);
+        if (frameTexture)
+            SDL_DestroyTexture(frameTexture);
+        destroySDL(window, renderer, font);
+    }
+    free(glyphBitmaps);
+    free(framebuffer);
+    free(unpackedIdx);
+    free(unpackedColors);
+    munmap((void *)data, fileSize);
     return 0;
 }
 
 
-// Array di caratteri ASCII ordinati in base alla "luminosità"
-// Modifica o aggiungi caratteri se desideri un diverso effetto ASCII art
-const char asciiChars[] = " .:-=+*#%@";
+// Divide rows righe tra size rank: le prime rows % size ricevono una riga in piu'
+void splitRows(int rows, int size, int *counts, int *starts) {
+    for (int r = 0, start = 0; r < size; ++r) {
+        counts[r] = rows / size + (r < rows % size ? 1 : 0);
+        starts[r] = start;
+        start += counts[r];
+    }
+}
 
-const int numChars = sizeof(asciiChars) - 1; // Numero di caratteri, escludendo il terminatore di stringa '\0'
+// Blocco rows x cols che parte da (rowStart, colStart) in una matrice totalRows x totalCols di element.
+// Con piu' rank che righe o colonne il blocco puo' essere vuoto: diventa un tipo di zero elementi
+MPI_Datatype createBlockType(int totalRows, int totalCols, int rows, int cols, int rowStart, int colStart, MPI_Datatype element) {
+    MPI_Datatype type;
+    if (rows == 0 || cols == 0) {
+        MPI_Type_contiguous(0, element, &type);
+    } else {
+        int sizes[2] = {totalRows, totalCols};
+        int subsizes[2] = {rows, cols};
+        int starts[2] = {rowStart, colStart};
+        MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, element, &type);
+    }
+    MPI_Type_commit(&type);
+    return type;
+}
 
-// Funzione per convertire il colore in scala di grigi
-uint8_t grayscale(uint8_t r, uint8_t g, uint8_t b) {
-    return (r+g+b) / 3;
+// Copia un blocco di celle contiguo nella griglia completa, le cui righe distano ASCII_WIDTH celle
+void placeBlock(const unsigned char *asciiArtIdx, const SDL_Color *asciiArtPixelColor, int w, int h, unsigned char *gridIdx, SDL_Color *gridColor) {
+    for (int y = 0; y < h; ++y) {
+        memcpy(&gridIdx[y * ASCII_WIDTH], &asciiArtIdx[y * w], w);
+        memcpy(&gridColor[y * ASCII_WIDTH], &asciiArtPixelColor[y * w], w * sizeof(SDL_Color));
+    }
 }
 
-inline uint8_t getCharIndex(uint8_t grayscale){
-    uint8_t _val =  grayscale * numChars / 255;
+// Trasporto in memoria condivisa (transport=shared, tutti i rank sullo stesso nodo): il decoder di
+// rank_first scrive i frame direttamente in un ring dentro una finestra MPI condivisa, ogni rank
+// converte sul posto la propria striscia e scrive celle (o pixel rasterizzati) nella griglia condivisa.
+// Nessuna copia dei dati, per ogni frame solo un Bcast dello slot pronto e una barriera a fine frame.
+void processFramesShared(MPI_Comm comm, int rank, int size, int rank_first, FrameRing *ring, RenderContext *render) {
+    const int cells = ASCII_WIDTH * ASCII_HEIGHT;
+    const size_t frameBytes = (size_t)width * height * 3;
+    const bool rasterize = operation_mode == GRAPHICS && render_mode == RENDER_SOFTWARE;
+    const int capacity = prefetch_frames + 1;
 
-    // Assicurati che l'indice sia compreso nell'intervallo corretto
-    if (_val < 0) {
-        _val = 0;
-    } else if (_val >= numChars) {
-        _val = numChars - 1;
+    // Layout della finestra: capacity frame BGR, indici, colori, framebuffer ARGB (solo renderer=software)
+    const size_t idxOffset = (capacity * frameBytes + 63) & ~(size_t)63;
+    const size_t colorOffset = (idxOffset + cells + 63) & ~(size_t)63;
+    const size_t rasterOffset = (colorOffset + cells * sizeof(SDL_Color) + 63) & ~(size_t)63;
+    const size_t windowBytes = rasterOffset + (rasterize ? (size_t)cells * PIXEL_SCALE * PIXEL_SCALE * sizeof(Uint32) : 0);
+
+    unsigned char *base = NULL;
+    MPI_Win win;
+    MPI_Win_allocate_shared(rank == rank_first ? windowBytes : 0, 1, MPI_INFO_NULL, comm, &base, &win);
+    if (rank != rank_first) {
+        MPI_Aint segmentBytes;
+        int dispUnit;
+        MPI_Win_shared_query(win, rank_first, &segmentBytes, &dispUnit, &base);
     }
 
-    return _val;
-}
+    unsigned char *allAsciiArtIdx = &base[idxOffset];
+    SDL_Color *allAsciiArtPixelColor = (SDL_Color *)&base[colorOffset];
+    Uint32 *framebuffer = (Uint32 *)&base[rasterOffset];
 
-// Funzione per ottenere il carattere ASCII corrispondente a un determinato valore di scala di grigi
-char getAsciiChar(uint8_t grayscale) {
-    // Mappatura del valore di scala di grigi all'indice del carattere ASCII
-    uint8_t index = getCharIndex(grayscale);
-    return asciiChars[index];
-}
+    int *rowCounts = (int *)malloc(size * sizeof(int)), *rowStarts = (int *)malloc(size * sizeof(int));
+    splitRows(ASCII_HEIGHT, size, rowCounts, rowStarts);
+    const int localHeight = rowCounts[rank];
+    const size_t pixelOffset = (size_t)rowStarts[rank] * CELL_SIZE * width * 3;
+    const int cellOffset = rowStarts[rank] * ASCII_WIDTH;
+    free(rowCounts);
+    free(rowStarts);
 
-void initializeSDL(SDL_Window **window, SDL_Renderer **renderer, TTF_Font **font) {
-    SDL_Init(SDL_INIT_VIDEO);
-    if (operation_mode == GRAPHICS)
-    {
-        *window = SDL_CreateWindow("Ascii video", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, ASCII_WIDTH * PIXEL_SCALE, ASCII_HEIGHT * PIXEL_SCALE, 0);
-        if (!(*window)) {
-            printf("Errore durante la creazione della finestra: %s\n", SDL_GetError());
-            MPI_Finalize();
-            exit(1);
-        }
-        
-        *renderer = SDL_CreateRenderer(*window, -1, 0);
-        if (!(*renderer)) {
-            printf("Errore durante la creazione del renderer: %s\n", SDL_GetError());
-            SDL_DestroyWindow(*window);
-            MPI_Finalize();
-            exit(1);
-        }
-    }
-    if (TTF_Init() == -1) {
-        printf("Errore durante l'inizializzazione della libreria TTF: %s\n", TTF_GetError());
-        SDL_DestroyRenderer(*renderer);
-        SDL_DestroyWindow(*window);
-        MPI_Finalize();
-        exit(1);
-    }
-    *font = TTF_OpenFont("sans.ttf", FONT_SIZE);
-    if (!(*font)) {
-        printf("Errore durante il caricamento del font: %s\n", TTF_GetError());
-        TTF_Quit();
-        SDL_DestroyRenderer(*renderer);
-        SDL_DestroyWindow(*window);
-        MPI_Finalize();
-        exit(1);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+    if (rank == rank_first)
+        startDecoder(ring, capacity, base);
+
+    for (int i = 0; ; ++i) {
+        #pragma region Frame_Pronto
+            int slot = -1;
+            if (rank == rank_first && i < nFrames) {
+                cv::Mat *frame = acquireFrame(ring);
+                if (frame == NULL) {
+                    if (!skippedToEnd())
+                        printf("Failed to extract frame\n");
+                } else if ((operation_mode == GRAPHICS && pollQuit()) || resolutionPending()) {
+                    releaseFrame(ring);
+                } else {
+                    slot = frame - ring->slots;
+                }
+            }
+
+            // Win_sync prima e dopo la sincronizzazione rende visibili le scritture del decoder
+            MPI_Win_sync(win);
+            MPI_Bcast(&slot, 1, MPI_INT, rank_first, comm);
+            MPI_Win_sync(win);
+            if (slot < 0)
+                break;
+        #pragma endregion
+
+        #pragma region Decodifica_frame
+            convertStrip(&base[slot * frameBytes + pixelOffset], width * 3, ASCII_WIDTH, localHeight,
+                         &allAsciiArtIdx[cellOffset], &allAsciiArtPixelColor[cellOffset]);
+            if (rasterize)
+                rasterizeCells(&allAsciiArtIdx[cellOffset], &allAsciiArtPixelColor[cellOffset], ASCII_WIDTH, localHeight, render->glyphBitmaps,
+                               &framebuffer[cellOffset * PIXEL_SCALE * PIXEL_SCALE], ASCII_WIDTH * PIXEL_SCALE);
+        #pragma endregion
+
+        #pragma region Frame_Finito
+            MPI_Win_sync(win);
+            MPI_Barrier(comm);
+            MPI_Win_sync(win);
+        #pragma endregion
+
+        if (rank != rank_first)
+            continue;
+
+        #pragma region Display_Frame
+            // Nessuno legge piu' lo slot: torna al decoder
+            const int number = frameNumber(ring, &ring->slots[slot]);
+            const bool show = frameDeadline(number);
+            releaseFrame(ring);
+            resolutionCheck(number);
+
+            if (render->recorder != NULL)
+                recordFrame(render->recorder, allAsciiArtIdx, allAsciiArtPixelColor);
+
+            if (rasterize && show)
+                displayFramebuffer(render->renderer, render->frameTexture, framebuffer);
+            else if (operation_mode == GRAPHICS && show)
+                displayFrame(render->renderer, render->atlas, allAsciiArtIdx, allAsciiArtPixelColor);
+            else if (operation_mode == TERMINAL && show)
+                displayTerminal(render->terminal, allAsciiArtIdx, allAsciiArtPixelColor);
+            else if (operation_mode == NO_GUI && i % 10 == 0)
+                printf("Done %d frames out of %d\n", i, nFrames);
+        #pragma endregion
     }
-}
 
-void destroySDL(SDL_Window *window, SDL_Renderer *renderer, TTF_Font *font) {
-    TTF_CloseFont(font);
-    TTF_Quit();
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
-    SDL_Quit();
+    // Il decoder scrive nella finestra: va fermato prima di liberarla
+    if (rank == rank_first)
+        stopDecoder(ring);
+    MPI_Win_unlock_all(win);
+    MPI_Win_free(&win);
 }
 
 
@@ -127,19 +3191,29 @@ void processFrames(int rank, int size) {
     SDL_Renderer *renderer = NULL;
     TTF_Font *font = NULL;
 
-    // Create 2D topology
-    int dims[2] = {0};
+    // Create 2D topology: dims[0] righe di rank per dims[1] colonne, grid_columns fissa le colonne
+    // (con 0 le sceglie MPI_Dims_create)
+    int dims[2] = {0, grid_columns};
     int periods[2] = {0};
     int coords[2] = {0};
 
-    MPI_Type_contiguous(sizeof(SDL_Color) , MPI_BYTE , &sdl_color);
-    MPI_Type_commit(&sdl_color);
-
     int rank_first, rank_last;
 
-    MPI_Dims_create(size, 1, dims);
-    MPI_Comm comm2D;
-    MPI_Cart_create(MPI_COMM_WORLD, 1, dims, periods, 1, &comm2D);
+    // Topologia e tipo dei colori non dipendono dalla griglia di celle: restano tra un'esecuzione e l'altra
+    if (comm2D == MPI_COMM_NULL) {
+        MPI_Type_contiguous(sizeof(SDL_Color) , MPI_BYTE , &sdl_color);
+        MPI_Type_commit(&sdl_color);
+
+        if (grid_columns > 0 && size % grid_columns != 0) {
+            if (rank == 0)
+                printf("grid_columns=%d does not divide %d ranks, choosing the grid automatically\n", grid_columns, size);
+            dims[1] = 0;
+        }
+
+        MPI_Dims_create(size, 2, dims);
+        MPI_Cart_create(MPI_COMM_WORLD, 2, dims, periods, 1, &comm2D);
+    }
+    MPI_Cart_get(comm2D, 2, dims, periods, coords);
     MPI_Comm_rank(comm2D, &rank);
     MPI_Comm_size(comm2D, &size);
     MPI_Cart_coords(comm2D, rank, 2, coords);
@@ -147,17 +3221,34 @@ void processFrames(int rank, int size) {
     int rank_up, rank_down;
     MPI_Cart_shift(comm2D, 0, 1, &rank_up, &rank_down);
 
-    const int top_coords[] = {0};
-    const int bottom_coords[] = {size-1};
+    const int top_coords[] = {0, 0};
+    const int bottom_coords[] = {dims[0] - 1, dims[1] - 1};
 
     MPI_Cart_rank(comm2D , top_coords , &rank_first);
     MPI_Cart_rank(comm2D , bottom_coords , &rank_last);
 
-    unsigned char *imagePixels = NULL;
-
     unsigned char *allAsciiArtIdx = NULL;
     SDL_Color *allAsciiArtPixelColor = NULL; 
-    SDL_Texture **asciiTextures = NULL;
+    resetRealtimeClock();
+    restartResolutionControl();
+    stageProfile.rank = rank;
+    RenderContext render = {NULL, NULL, NULL, NULL, NULL, NULL};
+    Uint32 *framebuffer = NULL;
+    FrameRing ring;
+
+    // Il trasporto in memoria condivisa funziona solo se tutti i rank sono sullo stesso nodo
+    int sharedTransport = 0;
+    if (transport_mode == TRANSPORT_SHARED && distribution_mode == SPATIAL && operation_mode != VIDEO_FILE) {
+        MPI_Comm nodeComm;
+        int nodeSize;
+        MPI_Comm_split_type(comm2D, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm);
+        MPI_Comm_size(nodeComm, &nodeSize);
+        MPI_Comm_free(&nodeComm);
+
+        sharedTransport = nodeSize == size;
+        if (!sharedTransport && rank == rank_first)
+            printf("transport=shared needs every rank on one node, using message passing\n");
+    }
 
     #pragma region Variabili_Init
         if (rank == rank_first) {
@@ -170,215 +3261,574 @@ void processFrames(int rank, int size) {
             width = videoStream.get(cv::CAP_PROP_FRAME_WIDTH);
             height = videoStream.get(cv::CAP_PROP_FRAME_HEIGHT);
             nFrames = videoStream.get(cv::CAP_PROP_FRAME_COUNT);
+            // Si parte da start_frame, i frame del ciclo sono contati da li'
+            if (start_frame >= nFrames)
+                start_frame = nFrames > 0 ? nFrames - 1 : 0;
+            nFrames -= start_frame;
 
             allAsciiArtPixelColor = (SDL_Color *)malloc((ASCII_WIDTH * ASCII_HEIGHT + 1) * sizeof(SDL_Color));
             allAsciiArtIdx = (unsigned char *)malloc((ASCII_WIDTH * ASCII_HEIGHT + 1) * sizeof(unsigned char) * 3);
-            asciiTextures = (SDL_Texture**)malloc(numChars * sizeof(SDL_Texture*));
 
-            memset(asciiTextures, 0, numChars * sizeof(SDL_Texture*));
             memset(allAsciiArtIdx, 0, (ASCII_WIDTH * ASCII_HEIGHT + 1) * sizeof(unsigned char) * 3);
             memset(allAsciiArtPixelColor, 0, (ASCII_WIDTH * ASCII_HEIGHT + 1) * sizeof(SDL_Color));
 
             printf("%d, %d\n", width, height);
 
-            initializeSDL(&window, &renderer, &font);
+            // Su file ogni rank decodifica da solo i propri blocchi, senza ring ne' finestra
+            if (operation_mode != VIDEO_FILE) {
+                // In modalita' temporale ogni frame in volo tiene occupato il suo slot fino alla presentazione,
+                // in quella spaziale la pipeline tiene occupati il frame corrente e il successivo
+                // con la memoria condivisa il ring nasce dentro la finestra, in processFramesShared
+                // con la decodifica a intervalli ogni rank legge il video da solo
+                if (!sharedTransport && distribution_mode != RANGES)
+                    startDecoder(&ring, prefetch_frames + (distribution_mode == TEMPORAL ? 2 * size : 2));
+
+                openDisplay(&window, &renderer, &font);
+                render.renderer = renderer;
+            }
 
-            SDL_Color textColor = {255, 255, 255, 255};
-            for (int i = 0; i < numChars; ++i){
-                SDL_Surface *asciiSurface = TTF_RenderText_Solid(font, &asciiChars[i], textColor);
-                asciiTextures[i] = SDL_CreateTextureFromSurface(renderer, asciiSurface);
+            if (operation_mode == GRAPHICS && render_mode == RENDER_SOFTWARE) {
+                render.frameTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, ASCII_WIDTH * PIXEL_SCALE, ASCII_HEIGHT * PIXEL_SCALE);
+                framebuffer = (Uint32 *)malloc(ASCII_WIDTH * PIXEL_SCALE * ASCII_HEIGHT * PIXEL_SCALE * sizeof(Uint32));
+                memset(framebuffer, 0, ASCII_WIDTH * PIXEL_SCALE * ASCII_HEIGHT * PIXEL_SCALE * sizeof(Uint32));
+            } else if (operation_mode == GRAPHICS) {
+                render.atlas = createGlyphAtlas(renderer, font);
+            } else if (operation_mode == TERMINAL) {
+                render.terminal = createTerminalOutput();
             }
 
+            if (record_path[0] != '\0' && operation_mode != VIDEO_FILE)
+                render.recorder = openRecorder(record_path);
+
         }
 
         MPI_Bcast(&width, 1, MPI_INT, rank_first, comm2D);
         MPI_Bcast(&height, 1, MPI_INT, rank_first, comm2D);
         MPI_Bcast(&nFrames, 1, MPI_INT, rank_first, comm2D);
         MPI_Bcast(&framerate, 1, MPI_INT, rank_first, comm2D);
+
+        // Il rasterizzatore software gira su ogni rank: chi non ha SDL aperto carica solo il font
+        if ((operation_mode == GRAPHICS && render_mode == RENDER_SOFTWARE) || operation_mode == VIDEO_FILE) {
+            if (font != NULL) {
+                render.glyphBitmaps = createGlyphBitmaps(font);
+            } else {
+                TTF_Init();
+                TTF_Font *glyphFont = TTF_OpenFont("sans.ttf", FONT_SIZE);
+                if (!glyphFont) {
+                    printf("Errore durante il caricamento del font: %s\n", TTF_GetError());
+                    MPI_Abort(comm2D, 1);
+                }
+                render.glyphBitmaps = createGlyphBitmaps(glyphFont);
+                TTF_CloseFont(glyphFont);
+                TTF_Quit();
+            }
+        }
     #pragma endregion 
 
-    int localHeight = ASCII_HEIGHT / dims[0];
-    int localWidth = ASCII_WIDTH ;
-    int startX = 0;
-    int startY = coords[0] * localHeight *localWidth;
+    if (operation_mode == VIDEO_FILE) {
+        processFramesToFile(comm2D, rank, size, rank_first, &render);
 
-    unsigned char *asciiArtIdx = 0;
-    
-    #pragma region Alloca_Memoria
-        SDL_Color *asciiArtPixelColor = (SDL_Color *)malloc((localWidth * localHeight + 1) * sizeof(SDL_Color));
-        memset(asciiArtPixelColor, 0, (localWidth * localHeight + 1) * sizeof(SDL_Color));
-        
-        if (rank != rank_first){
-            /*asciiArtIdx = (unsigned char *)malloc((localWidth * localHeight + 1) * sizeof(unsigned char));
-            memset(asciiArtIdx, 0, (localWidth * localHeight + 1) * sizeof(unsigned char));*/
+        free(allAsciiArtIdx);
+        free(allAsciiArtPixelColor);
+        free(render.glyphBitmaps);
+        return;
+    }
 
-            asciiArtPixelColor = (SDL_Color *)malloc((localWidth * localHeight + 1) * sizeof(SDL_Color));
-            memset(asciiArtPixelColor, 0, (localWidth * localHeight + 1) * sizeof(SDL_Color));
-        }else{
-            asciiArtIdx = allAsciiArtIdx;
-            asciiArtPixelColor = allAsciiArtPixelColor;
+    if (distribution_mode != SPATIAL || sharedTransport) {
+        if (sharedTransport)
+            processFramesShared(comm2D, rank, size, rank_first, &ring, &render);
+        else if (distribution_mode == DYNAMIC)
+            processFramesDynamic(comm2D, rank, size, rank_first, &ring, &render, allAsciiArtIdx, allAsciiArtPixelColor, framebuffer);
+        else if (distribution_mode == RANGES)
+            processFramesRanges(comm2D, rank, size, rank_first, &render, allAsciiArtIdx, allAsciiArtPixelColor, framebuffer);
+        else
+            processFramesTemporal(comm2D, rank, size, rank_first, &ring, &render);
+
+        if (rank == rank_first) {
+            if (!sharedTransport && distribution_mode != RANGES)
+                stopDecoder(&ring);
+            reportRealtime();
+            destroyGlyphAtlas(render.atlas);
+            destroyTerminalOutput(render.terminal);
+            closeRecorder(render.recorder);
+            if (render.frameTexture)
+                SDL_DestroyTexture(render.frameTexture);
         }
-    #pragma edregion 
 
+        free(allAsciiArtIdx);
+        free(allAsciiArtPixelColor);
+        free(render.glyphBitmaps);
+        free(framebuffer);
+        syncResolution(comm2D, rank_first);
+        if (!resolutionPending())
+            closeDisplay();
+        return;
+    }
 
-    int quit = 0;
-    cv::Mat frame;
-    SDL_Event event;
-    MPI_Request request;
+    // Distribuzione spaziale: ogni rank converte il blocco di celle della sua coordinata nella topologia 2D,
+    // nessuna riga o colonna scartata. Blocchi quasi quadrati tengono in cache il lavoro di ogni rank
+    // anche sui video larghi e non degenerano in strisce di poche righe con molti rank.
+    int *rowCounts = (int *)malloc(size * sizeof(int)), *rowStarts = (int *)malloc(size * sizeof(int));
+    int *colCounts = (int *)malloc(size * sizeof(int)), *colStarts = (int *)malloc(size * sizeof(int));
+    int *pixelCounts = (int *)malloc(size * sizeof(int)), *pixelDispls = (int *)malloc(size * sizeof(int));
+    int *cellCounts = (int *)malloc(size * sizeof(int)), *cellDispls = (int *)malloc(size * sizeof(int));
+    int *rasterCounts = (int *)malloc(size * sizeof(int)), *rasterDispls = (int *)malloc(size * sizeof(int));
+    int *gridRows = (int *)malloc(dims[0] * sizeof(int)), *gridRowStarts = (int *)malloc(dims[0] * sizeof(int));
+    int *gridCols = (int *)malloc(dims[1] * sizeof(int)), *gridColStarts = (int *)malloc(dims[1] * sizeof(int));
 
-    int frame_type = 16;
-    
-    for (int i = 0, framesdecoded = 0; i < nFrames && quit == 0; i ++, framesdecoded += size){
-        #pragma region Chiudi_Programma
-            if (operation_mode == GRAPHICS)
-            {
-                if (rank == rank_first) {
-                    SDL_PollEvent(&event);
-                    switch (event.type) {
-                        case SDL_QUIT:
-                            quit = 1;
-                            break;
-                    }
-                }
-                MPI_Bcast(&quit, 1, MPI_INT, rank_first, comm2D);
-            }
-        #pragma endregion
-        
-        //L'immagine sarà trasmessa da sinistra verso destra (quindi non per forza il rank 0 sarà il primo)
-        
-            if (rank == rank_first) {
-                #pragma region Estrai_frame
+    splitRows(ASCII_HEIGHT, dims[0], gridRows, gridRowStarts);
+    splitRows(ASCII_WIDTH, dims[1], gridCols, gridColStarts);
+    for (int r = 0; r < size; ++r) {
+        int blockCoords[2];
+        MPI_Cart_coords(comm2D, r, 2, blockCoords);
+        rowCounts[r] = gridRows[blockCoords[0]];
+        rowStarts[r] = gridRowStarts[blockCoords[0]];
+        colCounts[r] = gridCols[blockCoords[1]];
+        colStarts[r] = gridColStarts[blockCoords[1]];
+
+        // Byte BGR dei pixel che coprono il blocco, celle e pixel ARGB rasterizzati.
+        // I displs sono la posizione dell'angolo in alto a sinistra del blocco nel frame e nelle griglie
+        pixelCounts[r] = rowCounts[r] * CELL_SIZE * colCounts[r] * CELL_SIZE * 3;
+        pixelDispls[r] = rowStarts[r] * CELL_SIZE * width * 3 + colStarts[r] * CELL_SIZE * 3;
+        cellCounts[r] = rowCounts[r] * colCounts[r];
+        cellDispls[r] = rowStarts[r] * ASCII_WIDTH + colStarts[r];
+        rasterCounts[r] = cellCounts[r] * PIXEL_SCALE * PIXEL_SCALE;
+        rasterDispls[r] = rowStarts[r] * PIXEL_SCALE * ASCII_WIDTH * PIXEL_SCALE + colStarts[r] * PIXEL_SCALE;
+    }
 
-                    videoStream.set(cv::CAP_PROP_POS_FRAMES, i);
+    int localHeight = rowCounts[rank];
+    int localWidth = colCounts[rank];
+    int localCells = cellCounts[rank];
 
-                    if (!videoStream.read(frame)) {
-                        printf("Failed to extract frame\n");
-                        quit = 1;
-                        MPI_Bcast(&quit, 1, MPI_INT, rank_first, comm2D);
-                        break;
-                    }
+    const bool rasterize = operation_mode == GRAPHICS && render_mode == RENDER_SOFTWARE;
+    const bool gatherCells = !rasterize && (operation_mode != NO_GUI || record_path[0] != '\0');
 
-                    // Calcola la dimensione corretta della porzione di dati da inviare
-                    int sendSize = (ASCII_HEIGHT * ASCII_WIDTH * 3) - (localHeight * localWidth * 3);
+    // Pipeline a due stadi: mentre si converte il frame i le strisce del frame i+1 sono gia' in viaggio.
+    // Tutti i trasferimenti punto-punto usano richieste persistenti create una volta sola:
+    // rank_first ne ha una per ogni slot del ring e ogni rank, i worker due buffer per direzione.
+    const int peers = size - 1;
+    const int resultsPerPeer = (rasterize || cell_format != CELL_FULL) ? 1 : 2;
+    // transport=rma: i worker scrivono le celle con MPI_Put direttamente in una delle due griglie di rank_first,
+    // che intanto puo' presentare l'altra
+    const bool rmaResults = transport_mode == TRANSPORT_RMA && gatherCells && !delta_transport;
+    const bool pipelineResults = rasterize || (gatherCells && !delta_transport && !rmaResults);
+    // Celle compatte (cell_format): un solo messaggio per striscia con il tipo packed_cell
+    const bool packedResults = pipelineResults && !rasterize && cell_format != CELL_FULL;
+    const int packedBytes = cellFormatBytes(cell_format);
 
-                    // Invia solo la porzione di dati richiesta a destra
-                    if (rank_down != rank_first) 
-                        MPI_Isend(&frame.data[localHeight * localWidth * 3], sendSize, MPI_CHAR, rank_down, 0, comm2D, &request);
+    unsigned char *imagePixels2[2] = {NULL, NULL};
+    unsigned char *asciiArtIdx2[2] = {NULL, NULL};
+    SDL_Color *asciiArtPixelColor2[2] = {NULL, NULL};
+    Uint32 *stripFramebuffer2[2] = {NULL, NULL};
 
-                #pragma endregion
+    unsigned char *asciiArtIdx = NULL;
+    SDL_Color *asciiArtPixelColor = NULL;
+    Uint32 *stripFramebuffer = NULL;
+
+    unsigned char *packedGrid = NULL;
+    unsigned char *packedStrip2[2] = {NULL, NULL};
+    MPI_Datatype packed_cell;
+    MPI_Type_contiguous(packedBytes, MPI_BYTE, &packed_cell);
+    MPI_Type_commit(&packed_cell);
+
+    // Un tipo subarray per blocco e per griglia: tutti i trasferimenti partono o arrivano
+    // direttamente nel frame e nelle griglie complete, senza copie intermedie
+    MPI_Datatype *pixelBlock = (MPI_Datatype *)malloc(size * sizeof(MPI_Datatype));
+    MPI_Datatype *idxBlock = (MPI_Datatype *)malloc(size * sizeof(MPI_Datatype));
+    MPI_Datatype *colorBlock = (MPI_Datatype *)malloc(size * sizeof(MPI_Datatype));
+    MPI_Datatype *packedBlock = (MPI_Datatype *)malloc(size * sizeof(MPI_Datatype));
+    MPI_Datatype *rasterBlock = (MPI_Datatype *)malloc(size * sizeof(MPI_Datatype));
+    for (int r = 0; r < size; ++r) {
+        pixelBlock[r] = createBlockType(height, width * 3, rowCounts[r] * CELL_SIZE, colCounts[r] * CELL_SIZE * 3, rowStarts[r] * CELL_SIZE, colStarts[r] * CELL_SIZE * 3, MPI_CHAR);
+        idxBlock[r] = createBlockType(ASCII_HEIGHT, ASCII_WIDTH, rowCounts[r], colCounts[r], rowStarts[r], colStarts[r], MPI_CHAR);
+        colorBlock[r] = createBlockType(ASCII_HEIGHT, ASCII_WIDTH, rowCounts[r], colCounts[r], rowStarts[r], colStarts[r], sdl_color);
+        packedBlock[r] = createBlockType(ASCII_HEIGHT, ASCII_WIDTH, rowCounts[r], colCounts[r], rowStarts[r], colStarts[r], packed_cell);
+        rasterBlock[r] = createBlockType(ASCII_HEIGHT * PIXEL_SCALE, ASCII_WIDTH * PIXEL_SCALE, rowCounts[r] * PIXEL_SCALE, colCounts[r] * PIXEL_SCALE,
+                                         rowStarts[r] * PIXEL_SCALE, colStarts[r] * PIXEL_SCALE, MPI_UINT32_T);
+    }
+
+    MPI_Request *stripSend = NULL;      // rank_first: capacity * peers
+    MPI_Request *resultRecv = NULL;     // rank_first: peers * resultsPerPeer
+    MPI_Request stripRecv[2] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+    MPI_Request resultSend[2][2] = {{MPI_REQUEST_NULL, MPI_REQUEST_NULL}, {MPI_REQUEST_NULL, MPI_REQUEST_NULL}};
+    DeltaState *delta = NULL;
+
+    const MPI_Aint gridColorOffset = (ASCII_WIDTH * ASCII_HEIGHT + 63) & ~63;
+    const MPI_Aint gridBytes = gridColorOffset + ASCII_WIDTH * ASCII_HEIGHT * sizeof(SDL_Color);
+    unsigned char *rmaGrid = NULL;
+    MPI_Win rmaWin = MPI_WIN_NULL;
+
+    // Con una sola colonna di rank il blocco di rank_first e' contiguo nella griglia e ci si converte sopra,
+    // altrimenti lo converte a parte e lo copia al suo posto
+    const bool rootInGrid = localWidth == ASCII_WIDTH;
+    unsigned char *rootIdx = NULL;
+    SDL_Color *rootColor = NULL;
+
+    #pragma region Alloca_Memoria
+        // rank_first scrive il proprio blocco direttamente nella griglia completa e nel framebuffer,
+        // gli altri rank tengono solo il proprio blocco (due copie per la pipeline)
+        if (rank == rank_first) {
+            if (rootInGrid) {
+                asciiArtIdx = &allAsciiArtIdx[cellDispls[rank]];
+                asciiArtPixelColor = &allAsciiArtPixelColor[cellDispls[rank]];
             } else {
-                #pragma region Ricevi_frame_e_invia_porzione
-                    MPI_Status status;
+                rootIdx = (unsigned char *)malloc(localCells + 1);
+                rootColor = (SDL_Color *)malloc((localCells + 1) * sizeof(SDL_Color));
+                asciiArtIdx = rootIdx;
+                asciiArtPixelColor = rootColor;
+            }
+            if (rasterize)
+                stripFramebuffer = &framebuffer[rasterDispls[rank]];
 
-                    // Ottieni la dimensione del messaggio in arrivo
-                    int recvSize;
-                    MPI_Probe(rank_up, 0, comm2D, &status);
-                    MPI_Get_count(&status, MPI_CHAR, &recvSize);
+            stripSend = (MPI_Request *)malloc(ring.capacity * peers * sizeof(MPI_Request) + 1);
+            resultRecv = (MPI_Request *)malloc(peers * resultsPerPeer * sizeof(MPI_Request) + 1);
 
-                    // Alloca la memoria necessaria per ricevere il messaggio
-                    if (imagePixels == NULL) 
-                        imagePixels = (uint8_t*)malloc(recvSize * sizeof(uint8_t));
+            for (int k = 0; k < ring.capacity; ++k) {
+                for (int r = 0, j = 0; r < size; ++r) {
+                    if (r == rank_first)
+                        continue;
+                    MPI_Send_init(ring.slots[k].data, 1, pixelBlock[r], r, TAG_FRAME, comm2D, &stripSend[k * peers + j++]);
+                }
+            }
 
-                    asciiArtIdx = imagePixels;
+            if (packedResults)
+                packedGrid = (unsigned char *)malloc((size_t)ASCII_WIDTH * ASCII_HEIGHT * packedBytes + 1);
 
-                    // Ricevi il buffer dei pixel
-                    MPI_Recv(imagePixels, recvSize, MPI_CHAR, rank_up, 0, comm2D, &status);
+            for (int r = 0, j = 0; r < size && pipelineResults; ++r) {
+                if (r == rank_first)
+                    continue;
+                if (rasterize) {
+                    MPI_Recv_init(framebuffer, 1, rasterBlock[r], r, TAG_RESULT, comm2D, &resultRecv[j++]);
+                } else if (packedResults) {
+                    MPI_Recv_init(packedGrid, 1, packedBlock[r], r, TAG_RESULT, comm2D, &resultRecv[j++]);
+                } else {
+                    // Indici nella prima meta' delle richieste, colori nella seconda
+                    MPI_Recv_init(allAsciiArtIdx, 1, idxBlock[r], r, TAG_RESULT, comm2D, &resultRecv[j]);
+                    MPI_Recv_init(allAsciiArtPixelColor, 1, colorBlock[r], r, TAG_COLORS, comm2D, &resultRecv[peers + j++]);
+                }
+            }
+        } else {
+            for (int b = 0; b < 2; ++b) {
+                imagePixels2[b] = (unsigned char *)malloc(pixelCounts[rank] + 1);
+                asciiArtIdx2[b] = (unsigned char *)malloc(localCells + 1);
+                asciiArtPixelColor2[b] = (SDL_Color *)malloc((localCells + 1) * sizeof(SDL_Color));
 
-                    if (rank != rank_last) {
-                        // Calcola la dimensione corretta della porzione di dati da inviare
-                        int sendSize = recvSize - localHeight * localWidth * 3;
+                MPI_Recv_init(imagePixels2[b], pixelCounts[rank], MPI_CHAR, rank_first, TAG_FRAME, comm2D, &stripRecv[b]);
 
-                        // Invia solo la porzione di dati richiesta a destra
-                        MPI_Isend(&imagePixels[localWidth * localHeight * 3], sendSize, MPI_CHAR, rank_down, 0, comm2D, &request);
-                    }
-                #pragma endregion
+                if (rasterize) {
+                    stripFramebuffer2[b] = (Uint32 *)malloc(rasterCounts[rank] * sizeof(Uint32) + 1);
+                    MPI_Send_init(stripFramebuffer2[b], rasterCounts[rank], MPI_UINT32_T, rank_first, TAG_RESULT, comm2D, &resultSend[b][0]);
+                } else if (packedResults) {
+                    packedStrip2[b] = (unsigned char *)malloc((size_t)localCells * packedBytes + 1);
+                    MPI_Send_init(packedStrip2[b], localCells, packed_cell, rank_first, TAG_RESULT, comm2D, &resultSend[b][0]);
+                } else if (pipelineResults) {
+                    MPI_Send_init(asciiArtIdx2[b], localCells, MPI_CHAR, rank_first, TAG_RESULT, comm2D, &resultSend[b][0]);
+                    MPI_Send_init(asciiArtPixelColor2[b], localCells, sdl_color, rank_first, TAG_COLORS, comm2D, &resultSend[b][1]);
+                }
             }
-        
+        }
 
+        if (delta_transport && gatherCells)
+            delta = createDeltaState(localCells, cellCounts[rank_first], rank, size, rank_first);
 
-        //if (rank != rank_first) frame = cv::Mat(localHeight, localWidth, CV_8UC3, imagePixels);
-        //forziamo il formato rgba dato che sdl_color ha bisogno di 4 valori distinti (rgb causa glithces)
-        //cv::cvtColor(frame, frame, cv::COLOR_RGB2RGBA);
-        #pragma region Decodifica_frame
-            for (int y = 0; y < localHeight; y++) {
-                for (int x = 0; x < localWidth; x++) {
-                    unsigned char* pixels = (imagePixels == NULL) ? &frame.data[(y * frame.cols + x) * 3] : &imagePixels[(y * localWidth + x) * 3];
+        if (rmaResults) {
+            MPI_Win_allocate(rank == rank_first ? 2 * gridBytes : 0, 1, MPI_INFO_NULL, comm2D, &rmaGrid, &rmaWin);
+            MPI_Win_lock_all(MPI_MODE_NOCHECK, rmaWin);
+        }
+    #pragma endregion
+
+
+    int quit = 0;
+    cv::Mat *frame = NULL;
+
+    // Primo frame fuori dal ciclo: da qui in poi ogni iterazione annuncia e spedisce il successivo
+    if (rank == rank_first) {
+        frame = acquireFrame(&ring);
+        if (frame == NULL) {
+            if (!skippedToEnd())
+                printf("Failed to extract frame\n");
+            quit = 1;
+        } else if (operation_mode == GRAPHICS) {
+            quit = pollQuit();
+        }
+    }
+    MPI_Bcast(&quit, 1, MPI_INT, rank_first, comm2D);
+
+    if (!quit && nFrames > 0) {
+        if (rank == rank_first)
+            MPI_Startall(peers, &stripSend[(frame - ring.slots) * peers]);
+        else
+            MPI_Start(&stripRecv[0]);
+    } else {
+        quit = 1;
+    }
+
+    for (int i = 0; quit == 0; i ++){
+        const int b = i % 2;
+        const int shownFrame = rank == rank_first ? frameNumber(&ring, frame) : 0;
+        int next = 0;
+        cv::Mat *nextFrame = NULL;
+        MPI_Request nextRequest;
+
+        #pragma region Estrai_frame
+            double stageStart = MPI_Wtime();
+            if (rank == rank_first && i + 1 < nFrames) {
+                nextFrame = acquireFrame(&ring);
+                next = nextFrame != NULL;
+                if (!next && !skippedToEnd())
+                    printf("Failed to extract frame\n");
+            }
+            if (rank == rank_first && ((operation_mode == GRAPHICS && pollQuit()) || resolutionPending())) {
+                if (nextFrame != NULL)
+                    releaseFrame(&ring);
+                nextFrame = NULL;
+                next = 0;
+            }
+            if (rank == rank_first)
+                stageTime(STAGE_EXTRACT, stageStart);
+        #pragma endregion
 
-                    uint8_t b = *pixels++;
-                    uint8_t g = *pixels++;
-                    uint8_t r = *pixels++;
+        #pragma region Distribuisci_Strisce
+            // Annuncia se arriva un altro frame e, se si', ne spedisce subito le strisce
+            stageStart = MPI_Wtime();
+            MPI_Ibcast(&next, 1, MPI_INT, rank_first, comm2D, &nextRequest);
 
-                    uint8_t grayscaleValue = grayscale(r, g, b);
-                    asciiArtIdx[(y * localWidth + x)] = getCharIndex(grayscaleValue);
+            if (rank == rank_first) {
+                if (next)
+                    MPI_Startall(peers, &stripSend[(nextFrame - ring.slots) * peers]);
 
-                    //opencv usa bgr non rgb, quindi swap
-                    SDL_Color c = {b, g, r, 255};
-                    asciiArtPixelColor[y * localWidth + x] = c;
+                if (rmaResults && rootInGrid) {
+                    asciiArtIdx = &rmaGrid[b * gridBytes + cellDispls[rank]];
+                    asciiArtPixelColor = (SDL_Color *)&rmaGrid[b * gridBytes + gridColorOffset] + cellDispls[rank];
                 }
+            } else {
+                MPI_Wait(&stripRecv[b], MPI_STATUS_IGNORE);
+                MPI_Wait(&nextRequest, MPI_STATUS_IGNORE);
+                if (next)
+                    MPI_Start(&stripRecv[1 - b]);
+                stageTime(STAGE_SEND, stageStart);
+
+                // Il buffer b e' stato spedito due frame fa, prima di riscriverlo l'invio deve essere finito
+                stageStart = MPI_Wtime();
+                MPI_Waitall(resultsPerPeer, resultSend[b], MPI_STATUSES_IGNORE);
+                stageTime(STAGE_RESULT_SEND, stageStart);
+                asciiArtIdx = asciiArtIdx2[b];
+                asciiArtPixelColor = asciiArtPixelColor2[b];
+                stripFramebuffer = stripFramebuffer2[b];
             }
         #pragma endregion
+
+        #pragma region Decodifica_frame
+            stageStart = MPI_Wtime();
+            if (rank == rank_first)
+                convertStrip(&frame->data[pixelDispls[rank]], frame->step, localWidth, localHeight, asciiArtIdx, asciiArtPixelColor);
+            else
+                convertStrip(imagePixels2[b], localWidth * CELL_SIZE * 3, localWidth, localHeight, asciiArtIdx, asciiArtPixelColor);
+            stageTime(STAGE_CONVERT, stageStart);
+        #pragma endregion
+
+        if (rank == rank_first) {
+            // Lo slot del ring torna al decoder solo quando le strisce sono state consegnate
+            stageStart = MPI_Wtime();
+            MPI_Waitall(peers, &stripSend[(frame - ring.slots) * peers], MPI_STATUSES_IGNORE);
+            releaseFrame(&ring);
+            stageTime(STAGE_SEND, stageStart);
+        }
        
-        if (operation_mode == GRAPHICS)
+        if (rasterize)
         {
-            //MPI_Gather(asciiArtIdx, localWidth * localHeight, MPI_CHAR, allAsciiArtIdx, localWidth * localHeight, MPI_CHAR, rank_first, comm2D);
-            
+            #pragma region Rasterizza_Striscia
+                // Ogni rank disegna il proprio blocco, rank_first raccoglie solo l'immagine finale
+                stageStart = MPI_Wtime();
+                rasterizeCells(asciiArtIdx, asciiArtPixelColor, localWidth, localHeight, render.glyphBitmaps, stripFramebuffer,
+                               (rank == rank_first ? ASCII_WIDTH : localWidth) * PIXEL_SCALE);
+                stageTime(STAGE_RENDER, stageStart);
+
+                if (rank == rank_first) {
+                    stageStart = MPI_Wtime();
+                    MPI_Startall(peers, resultRecv);
+                    MPI_Waitall(peers, resultRecv, MPI_STATUSES_IGNORE);
+                    stageTime(STAGE_GATHER_RASTER, stageStart);
+
+                    if (frameDeadline(shownFrame)) {
+                        stageStart = MPI_Wtime();
+                        displayFramebuffer(renderer, render.frameTexture, framebuffer);
+                        stageTime(STAGE_RENDER, stageStart);
+                    }
+                } else {
+                    MPI_Start(&resultSend[b][0]);
+                }
+            #pragma endregion
+        }
+        else if (gatherCells)
+        {
+            unsigned char *gridIdx = rmaResults ? &rmaGrid[b * gridBytes] : allAsciiArtIdx;
+            SDL_Color *gridColor = rmaResults ? (SDL_Color *)&rmaGrid[b * gridBytes + gridColorOffset] : allAsciiArtPixelColor;
+
             #pragma region Ricevi_Frame_Decodificato
-                if (rank == rank_last){
-                    MPI_Isend(asciiArtIdx, localHeight * localWidth, MPI_CHAR, rank_up, 0, comm2D, &request);
+                int gatherStage = rank == rank_first ? STAGE_GATHER_INDEX : STAGE_RESULT_SEND;
+                stageStart = MPI_Wtime();
+                if (rank == rank_first && !rootInGrid && !packedResults)
+                    placeBlock(asciiArtIdx, asciiArtPixelColor, localWidth, localHeight, &gridIdx[cellDispls[rank]], &gridColor[cellDispls[rank]]);
+
+                if (rmaResults){
+                    // Un solo punto di sincronizzazione per frame: flush delle Put e barriera.
+                    // Le Put del frame i+1 vanno nell'altra griglia, quindi non toccano quella presentata
+                    if (rank != rank_first) {
+                        MPI_Put(asciiArtIdx, localCells, MPI_CHAR, rank_first, b * gridBytes, 1, idxBlock[rank], rmaWin);
+                        MPI_Put(asciiArtPixelColor, localCells, sdl_color, rank_first, b * gridBytes + gridColorOffset, 1, colorBlock[rank], rmaWin);
+                        MPI_Win_flush(rank_first, rmaWin);
+                    }
+                    MPI_Barrier(comm2D);
+                    if (rank == rank_first)
+                        MPI_Win_sync(rmaWin);
+                }else if (delta != NULL){
+                    gatherDelta(delta, comm2D, rank, size, rank_first, i, asciiArtIdx, asciiArtPixelColor, allAsciiArtIdx, allAsciiArtPixelColor, cellCounts, cellDispls, colCounts);
+                }else if (rank == rank_first){
+                    // Prima tutti gli indici, poi tutti i colori, per misurarli separatamente
+                    MPI_Startall(peers * resultsPerPeer, resultRecv);
+                    MPI_Waitall(peers, resultRecv, MPI_STATUSES_IGNORE);
+                    if (resultsPerPeer == 2) {
+                        stageTime(STAGE_GATHER_INDEX, stageStart);
+                        stageStart = MPI_Wtime();
+                        gatherStage = STAGE_GATHER_COLOR;
+                        MPI_Waitall(peers, &resultRecv[peers], MPI_STATUSES_IGNORE);
+                    }
+
+                    // Anche il blocco di rank_first passa dal formato compatto, cosi' tutta l'immagine ha la stessa resa
+                    if (packedResults) {
+                        for (int y = 0; y < localHeight; ++y)
+                            packCells(cell_format, &asciiArtIdx[y * localWidth], &asciiArtPixelColor[y * localWidth], localWidth,
+                                      &packedGrid[(size_t)(cellDispls[rank] + y * ASCII_WIDTH) * packedBytes]);
+                        unpackCells(cell_format, packedGrid, ASCII_WIDTH * ASCII_HEIGHT, allAsciiArtIdx, allAsciiArtPixelColor);
+                    }
                 }else{
-                    
-                    int recvSize;
-                    MPI_Status status;
-                    MPI_Probe(rank_down, 0, comm2D, &status);
-                    MPI_Get_count(&status, MPI_CHAR, &recvSize);
-                    
-                    //if (rank != rank_first) memcpy(imagePixels, asciiArtIdx, localWidth * localHeight);
-
-                    MPI_Recv((rank == rank_first) ? &allAsciiArtIdx[localWidth * localHeight] :
-                            &imagePixels[localWidth * localHeight], recvSize, MPI_CHAR, rank_down, 0, comm2D, &status);
-                
-                    if (rank != rank_first)
-                        MPI_Isend(imagePixels, (localHeight * localWidth) + recvSize, MPI_CHAR, rank_up, 0, comm2D, &request);
+                    if (packedResults)
+                        packCells(cell_format, asciiArtIdx, asciiArtPixelColor, localCells, packedStrip2[b]);
+                    MPI_Startall(resultsPerPeer, resultSend[b]);
                 }
-
-                MPI_Gather(asciiArtPixelColor, localWidth * localHeight, sdl_color, allAsciiArtPixelColor, localWidth * localHeight, sdl_color, rank_first, comm2D);
+                stageTime(gatherStage, stageStart);
             #pragma endregion
             
             #pragma region Display_Frame
-                if (rank == rank_first) {
-                    SDL_RenderClear(renderer);
+                const bool show = rank == rank_first && frameDeadline(shownFrame);
 
-                    SDL_Rect destRect;
-                    destRect.w = PIXEL_SCALE;
-                    destRect.h = PIXEL_SCALE;
+                stageStart = MPI_Wtime();
+                if (rank == rank_first && render.recorder != NULL)
+                    recordFrame(render.recorder, gridIdx, gridColor);
+
+                if (show && operation_mode == TERMINAL) {
+                    displayTerminal(render.terminal, gridIdx, gridColor);
+                } else if (show && operation_mode == GRAPHICS) {
+                    displayFrame(renderer, render.atlas, gridIdx, gridColor);
+                }
+                if (rank == rank_first)
+                    stageTime(STAGE_RENDER, stageStart);
+            #pragma endregion
+        }
+            
+        // Senza celle da raccogliere il ritmo lo da' solo la scadenza
+        if (!rasterize && !gatherCells && rank == rank_first)
+            frameDeadline(shownFrame);
+        if (rank == rank_first)
+            resolutionCheck(shownFrame);
 
-                    for (int y = 0; y < ASCII_HEIGHT; y++) {
-                        for (int x = 0; x < ASCII_WIDTH; x++) {
-                            destRect.x = x * PIXEL_SCALE;
-                            destRect.y = y * PIXEL_SCALE;
+        if (operation_mode == NO_GUI && rank == rank_first && i % 10 == 0){
+            printf("Done %d frames out of %d\n", i, nFrames);
+        }
 
-                            SDL_Color c = allAsciiArtPixelColor[y * ASCII_WIDTH + x];
+        if (rank == rank_first)
+            MPI_Wait(&nextRequest, MPI_STATUS_IGNORE);
+        stageFrame();
 
-                            SDL_SetTextureColorMod(asciiTextures[allAsciiArtIdx[y * ASCII_WIDTH + x]], c.b, c.g, c.r);
+        frame = nextFrame;
+        quit = !next;
+    }
 
-                            SDL_RenderCopy(renderer, asciiTextures[allAsciiArtIdx[y * ASCII_WIDTH + x]], NULL, &destRect);
-                        }
-                    }
+    #pragma region Libera_Richieste
+        if (rmaResults) {
+            MPI_Win_unlock_all(rmaWin);
+            MPI_Win_free(&rmaWin);
+        }
 
-                    SDL_RenderPresent(renderer);
+        if (rank == rank_first) {
+            for (int k = 0; k < ring.capacity * peers; ++k)
+                MPI_Request_free(&stripSend[k]);
+            for (int k = 0; k < peers * resultsPerPeer && pipelineResults; ++k)
+                MPI_Request_free(&resultRecv[k]);
+            free(stripSend);
+            free(resultRecv);
+        } else {
+            for (int b = 0; b < 2; ++b) {
+                MPI_Waitall(resultsPerPeer, resultSend[b], MPI_STATUSES_IGNORE);
+                MPI_Request_free(&stripRecv[b]);
+                for (int k = 0; k < resultsPerPeer; ++k) {
+                    if (resultSend[b][k] != MPI_REQUEST_NULL)
+                        MPI_Request_free(&resultSend[b][k]);
                 }
-            }else if (rank == rank_first && i % 10 == 0){
-                printf("Done %d frames out of %d\n", i, nFrames);
             }
-        #pragma endregion
-    }
+        }
+    #pragma endregion
     
     if (rank == rank_first) {
-        destroySDL(window, renderer, font);
+        stopDecoder(&ring);
+        reportRealtime();
+        destroyGlyphAtlas(render.atlas);
+        destroyTerminalOutput(render.terminal);
+        closeRecorder(render.recorder);
+        if (render.frameTexture)
+            SDL_DestroyTexture(render.frameTexture);
     }
     
+    if (delta != NULL && rank == rank_first && delta->fullBytes > 0) {
+        printf("Delta transport: %ld bytes instead of %ld (%.1f%%)\n", delta->sentBytes, delta->fullBytes, 100.0 * delta->sentBytes / delta->fullBytes);
+    }
+    destroyDeltaState(delta);
+
+    for (int r = 0; r < size; ++r) {
+        MPI_Type_free(&pixelBlock[r]);
+        MPI_Type_free(&idxBlock[r]);
+        MPI_Type_free(&colorBlock[r]);
+        MPI_Type_free(&packedBlock[r]);
+        MPI_Type_free(&rasterBlock[r]);
+    }
+    free(pixelBlock);
+    free(idxBlock);
+    free(colorBlock);
+    free(packedBlock);
+    free(rasterBlock);
+    MPI_Type_free(&packed_cell);
+    free(packedGrid);
+    free(rootIdx);
+    free(rootColor);
+    for (int b = 0; b < 2; ++b) {
+        free(packedStrip2[b]);
+        free(imagePixels2[b]);
+        free(asciiArtIdx2[b]);
+        free(asciiArtPixelColor2[b]);
+        free(stripFramebuffer2[b]);
+    }
     free(allAsciiArtIdx);
-    free(asciiTextures);
+    free(allAsciiArtPixelColor);
+    free(render.glyphBitmaps);
+    free(framebuffer);
+    free(rowCounts);
+    free(rowStarts);
+    free(colCounts);
+    free(colStarts);
+    free(gridRows);
+    free(gridRowStarts);
+    free(gridCols);
+    free(gridColStarts);
+    free(pixelCounts);
+    free(pixelDispls);
+    free(cellCounts);
+    free(cellDispls);
+    free(rasterCounts);
+    free(rasterDispls);
+    syncResolution(comm2D, rank_first);
+    if (!resolutionPending())
+        closeDisplay();
 }
 
 int parseVideoConfig(const char* filename, int* op_mode, int* scaleSize) {
@@ -391,7 +3841,7 @@ int parseVideoConfig(const char* filename, int* op_mode, int* scaleSize) {
     char line[256];
     while (fgets(line, sizeof(line), file)) {
         // Remove newline character
-        line[strcspn(line, "\n")] = '\0';
+        line[strcspn(line, "\r\n")] = '\0';
 
         // Find the key-value separator
         char* separator = strchr(line, '=');
@@ -419,9 +3869,90 @@ int parseVideoConfig(const char* filename, int* op_mode, int* scaleSize) {
         } else if (strcmp(fileKey, "scale_size") == 0) {
             *scaleSize = atoi(fileValue);
         }else if (strcmp(fileKey, "profiler") == 0){
-            operation_mode = abs(atoi(fileValue)-1); //if profiles value is 1: 1-1 = 0 so profiler enabled, else abs(0-1) = 1, profiler disabled
+            //profiler=1 forza la modalita' 0 (profiler), profiler=0 porta la modalita' 0 in grafica e lascia le altre
+            if (atoi(fileValue) == 1)
+                operation_mode = NO_GUI;
+            else if (operation_mode == NO_GUI)
+                operation_mode = GRAPHICS;
         }else if (strcmp(fileKey, "video_path") == 0){
             strcpy(video_path, fileValue);
+        }else if (strcmp(fileKey, "cell_size") == 0){
+            CELL_SIZE = atoi(fileValue);
+        }else if (strcmp(fileKey, "ramp") == 0){
+            if (strcmp(fileValue, "long") == 0)
+                ramp_id = RAMP_LONG;
+            else if (strcmp(fileValue, "blocks") == 0)
+                ramp_id = RAMP_BLOCKS;
+            else
+                ramp_id = RAMP_SHORT;
+        }else if (strcmp(fileKey, "renderer") == 0){
+            render_mode = (strcmp(fileValue, "software") == 0) ? RENDER_SOFTWARE : RENDER_GEOMETRY;
+        }else if (strcmp(fileKey, "simd") == 0){
+            use_simd = atoi(fileValue);
+        }else if (strcmp(fileKey, "prefetch") == 0){
+            prefetch_frames = atoi(fileValue);
+        }else if (strcmp(fileKey, "output_path") == 0){
+            strcpy(output_path, fileValue);
+        }else if (strcmp(fileKey, "chunk_frames") == 0){
+            chunk_frames = atoi(fileValue) > 0 ? atoi(fileValue) : 1;
+        }else if (strcmp(fileKey, "record_path") == 0){
+            strcpy(record_path, fileValue);
+        }else if (strcmp(fileKey, "playback_path") == 0){
+            strcpy(playback_path, fileValue);
+        }else if (strcmp(fileKey, "delta") == 0){
+            delta_transport = atoi(fileValue);
+        }else if (strcmp(fileKey, "keyframe_interval") == 0){
+            keyframe_interval = atoi(fileValue) > 0 ? atoi(fileValue) : 1;
+        }else if (strcmp(fileKey, "cell_format") == 0){
+            if (strcmp(fileValue, "rgb565") == 0)
+                cell_format = CELL_RGB565;
+            else if (strcmp(fileValue, "rgb444") == 0)
+                cell_format = CELL_RGB444;
+            else if (strcmp(fileValue, "palette") == 0)
+                cell_format = CELL_PALETTE;
+            else
+                cell_format = CELL_FULL;
+        }else if (strcmp(fileKey, "palette") == 0){
+            if (strcmp(fileValue, "xterm256") == 0)
+                palette_mode = PALETTE_XTERM256;
+            else if (strcmp(fileValue, "ansi16") == 0)
+                palette_mode = PALETTE_ANSI16;
+            else if (strcmp(fileValue, "adaptive") == 0)
+                palette_mode = PALETTE_ADAPTIVE;
+            else
+                palette_mode = PALETTE_NONE;
+        }else if (strcmp(fileKey, "transport") == 0){
+            if (strcmp(fileValue, "shared") == 0)
+                transport_mode = TRANSPORT_SHARED;
+            else if (strcmp(fileValue, "rma") == 0)
+                transport_mode = TRANSPORT_RMA;
+            else
+                transport_mode = TRANSPORT_MESSAGE;
+        }else if (strcmp(fileKey, "distribution") == 0){
+            if (strcmp(fileValue, "temporal") == 0)
+                distribution_mode = TEMPORAL;
+            else if (strcmp(fileValue, "dynamic") == 0)
+                distribution_mode = DYNAMIC;
+            else if (strcmp(fileValue, "ranges") == 0)
+                distribution_mode = RANGES;
+            else
+                distribution_mode = SPATIAL;
+        }else if (strcmp(fileKey, "profile_output") == 0){
+            strcpy(profile_output, fileValue);
+        }else if (strcmp(fileKey, "adaptive") == 0){
+            adaptive_mode = atoi(fileValue);
+        }else if (strcmp(fileKey, "adaptive_max_cell") == 0){
+            adaptive_max_cell = atoi(fileValue);
+        }else if (strcmp(fileKey, "realtime") == 0){
+            realtime_mode = atoi(fileValue);
+        }else if (strcmp(fileKey, "start_frame") == 0){
+            start_frame = atoi(fileValue) > 0 ? atoi(fileValue) : 0;
+        }else if (strcmp(fileKey, "threads") == 0){
+            thread_count = atoi(fileValue) > 0 ? atoi(fileValue) : 1;
+        }else if (strcmp(fileKey, "grid_columns") == 0){
+            grid_columns = atoi(fileValue) > 0 ? atoi(fileValue) : 0;
+        }else if (strcmp(fileKey, "tile_rows") == 0){
+            tile_rows = atoi(fileValue) > 0 ? atoi(fileValue) : 1;
         }
     }
 
@@ -448,6 +3979,10 @@ void profiler(int rank, int size){
         }
     }
 
+    char path[300];
+    profilePath(path, profile_output[0] != '\0' ? profile_output : "profile.csv", "nogui");
+    reportStageProfile(path);
+
     MPI_Barrier(MPI_COMM_WORLD);
     printf("Con grafica\n");
 
@@ -465,13 +4000,17 @@ void profiler(int rank, int size){
             printf("Time per frame: %2.5fms, correct frame ms: %2.5fms\n", (finaleTime/nFrames) * 1000, (1.f/framerate) * 1000);
         }
     }
+
+    profilePath(path, profile_output[0] != '\0' ? profile_output : "profile.csv", "gui");
+    reportStageProfile(path);
 }
 
 
 int main(int argc, char *argv[]) {
-    int rank, size;
+    int rank, size, provided;
     
-    MPI_Init(&argc, &argv);
+    // Solo il thread principale chiama MPI, il decoder e il pool di thread lavorano su memoria locale
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
@@ -480,11 +4019,92 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
-    if (operation_mode == 0){
+    if (CELL_SIZE <= 0)
+        CELL_SIZE = PIXEL_SCALE;
+
+    const char *kernel = selectConvertKernel();
+    if (rank == 0)
+        printf("Conversion kernel: %s, %d characters\n", kernel, numChars);
+
+    // L'indice serve gia' alla palette adattiva per campionare il video
+    if (video_path[0] != '\0' && playback_path[0] == '\0')
+        loadVideoIndex(rank);
+
+    initPalette(rank);
+
+    if (provided < MPI_THREAD_FUNNELED && rank == 0)
+        printf("The MPI library does not provide MPI_THREAD_FUNNELED, threads may be unsafe\n");
+    startPool(thread_count);
+    if (rank == 0 && thread_count > 1)
+        printf("%d threads per rank\n", thread_count);
+
+    if (cell_format == CELL_PALETTE && palette_mode == PALETTE_NONE) {
+        if (rank == 0)
+            printf("cell_format=palette needs a palette, using full cells\n");
+        cell_format = CELL_FULL;
+    }
+
+    // L'indice a 4 bit di CELL_RGB444 non basta per le rampe lunghe
+    if (cell_format == CELL_RGB444 && numChars > 16) {
+        if (rank == 0)
+            printf("cell_format=rgb444 needs at most 16 characters, using rgb565\n");
+        cell_format = CELL_RGB565;
+    }
+
+    // La registrazione salva la griglia di celle, che il rasterizzatore software non ricompone mai
+    if (record_path[0] != '\0' && render_mode == RENDER_SOFTWARE) {
+        if (rank == 0)
+            printf("record_path needs the cell grid, using renderer=geometry\n");
+        render_mode = RENDER_GEOMETRY;
+    }
+
+    // Le celle compatte viaggiano solo nella raccolta a messaggi della distribuzione spaziale;
+    // altrove resta comunque valido il formato della registrazione
+    const bool packedTransport = distribution_mode == SPATIAL && transport_mode == TRANSPORT_MESSAGE && !delta_transport &&
+                                 operation_mode != VIDEO_FILE && !(operation_mode == GRAPHICS && render_mode == RENDER_SOFTWARE);
+    if (cell_format != CELL_FULL && !packedTransport) {
+        if (record_path[0] != '\0') {
+            if (rank == 0)
+                printf("cell_format packs only the recording here, cells are exchanged as full cells\n");
+        } else {
+            if (rank == 0)
+                printf("cell_format needs distribution=spatial with message passing (no transport=rma/shared, delta=1 or renderer=software), using full cells\n");
+            cell_format = CELL_FULL;
+        }
+    }
+
+    // La griglia cambia misura a ogni livello: registrazione e file in uscita ne vogliono una sola
+    if (adaptive_mode && (record_path[0] != '\0' || operation_mode == VIDEO_FILE || operation_mode == NO_GUI || distribution_mode == RANGES)) {
+        if (rank == 0)
+            printf("adaptive=1 needs live output from the frame decoder, keeping cell_size fixed\n");
+        adaptive_mode = 0;
+    }
+    initResolutionControl();
+
+    stageProfile.rank = rank;
+    stageProfile.active = profile_output[0] != '\0' || operation_mode == 0;
+
+    if (playback_path[0] != '\0'){
+        if (rank == 0)
+            playRecording(playback_path);
+    }else if (operation_mode == 0){
         profiler(rank, size);
-    }else
-        processFrames(rank, size);
+    }else{
+        do {
+            processFrames(rank, size);
+        } while (applyResolutionChange(rank));
+
+        if (stageProfile.active)
+            reportStageProfile(profile_output);
+    }
 
+    stopPool();
+    freeVideoIndex();
+    free(stageProfile.samples);
+    if (comm2D != MPI_COMM_NULL) {
+        MPI_Comm_free(&comm2D);
+        MPI_Type_free(&sdl_color);
+    }
     MPI_Finalize();
     return 0;
 }
@@ -494,8 +4114,9 @@ int main(int argc, char *argv[]) {
 //sudo apt install ffmpeg
 //sudo apt install libavformat-dev
 //sudo apt install libopencv-dev
+//sudo apt install libsdl2-dev libsdl2-ttf-dev (SDL >= 2.0.18 per SDL_RenderGeometry)
 //to compile it
-//mpic++ main.c -o a -lSDL2 -lSDL2_ttf -I/usr/include/opencv4 -lopencv_core -lopencv_imgproc -lopencv_video -lopencv_videoio
+//mpic++ main.c -o a -pthread -lSDL2 -lSDL2_ttf -I/usr/include/opencv4 -lopencv_core -lopencv_imgproc -lopencv_video -lopencv_videoio
 
 /*
 
@@ -4,11 +4,41 @@
 
 #define NO_GUI   0
 #define GRAPHICS 1
+#define TERMINAL 2
+#define VIDEO_FILE 3
+
+#define SPATIAL  0
+#define TEMPORAL 1
+#define DYNAMIC  2
+#define RANGES   3
+
+#define RAMP_SHORT  0
+#define RAMP_LONG   1
+#define RAMP_BLOCKS 2
+
+#define RENDER_GEOMETRY 0
+#define RENDER_SOFTWARE 1
+
+#define CELL_FULL   0
+#define CELL_RGB565 1
+#define CELL_RGB444 2
+#define CELL_PALETTE 3
+
+#define PALETTE_NONE     0
+#define PALETTE_XTERM256 1
+#define PALETTE_ANSI16   2
+#define PALETTE_ADAPTIVE 3
+
+#define TRANSPORT_MESSAGE 0
+#define TRANSPORT_SHARED  1
+#define TRANSPORT_RMA     2
 
 
 #define GET_VIDEO_FRAMERATE "ffprobe -v 0 -of csv=p=0 -select_streams v:0 -show_entries stream=r_frame_rate ./video/test.mp4"
 #define GET_VIDEO_DURATION  "ffprobe -i ./video/test.mp4 -v quiet -show_entries format=duration -hide_banner -of default=noprint_wrappers=1:nokey=1"
 #define GET_VIDEO_FRAME     "ffmpeg  -i ./video/test.mp4 select='between(n,%d,%d)' -frames:v 1 ./frames/%03d.bmp"
 #define GET_VIDEO_WIDTH     "ffprobe -v error -select_streams v:0 -show_entries stream=width -of default=nw=1:nk=1 ./video/test.mp4"
+#define GET_VIDEO_INDEX     "ffprobe -v error -select_streams v:0 -show_entries packet=pts_time,pos,flags -of csv=p=0 %s 2>/dev/null"
+#define CONCAT_VIDEO_PARTS  "ffmpeg -v error -y -f concat -safe 0 -i %s -c copy %s"
 #define GET_VIDEO_HEIGHT    "ffprobe -v error -select_streams v:0 -show_entries stream=height -of default=nw=1:nk=1 ./video/test.mp4"
 